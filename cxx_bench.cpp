@@ -0,0 +1,421 @@
+/**
+ * cxx_bench.cpp - this file is part of cxx-opcodes.
+ *
+ * Copyright (C) 2021 by Michael Gogins
+ *
+ * cxx-opcodes is free software; you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cxxopcodes is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cxx-opcodes; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * This file implements the `cxx_bench` benchmark harness. It drives Csound
+ * through its API, without audio, with these opcodes loaded as a plugin,
+ * and measures:
+ *
+ * 1. The latency of `cxx_compile` with a cold module cache, and with the
+ *    module already in the cache.
+ * 2. The init throughput of `cxx_invoke`, in notes per second, against the
+ *    number of loaded modules, with a native instrument as the baseline.
+ * 3. The overhead of `cxx_invoke` per voice and kperiod, against a native
+ *    opcode doing the same arithmetic.
+ * 4. The cost per note of creating and deleting an invokable, for heap
+ *    allocated and for placement constructed invokables.
+ *
+ * The results are written to the standard output as one JSON object, so
+ * that they can be compared between builds. What Csound prints is written
+ * to the standard error output only for runs that fail; then the measures
+ * of that phase are null, the phase has an "error", and the exit status is
+ * 1. Usage:
+ *
+ * cxx_bench [--quick] [--opcode-lib FILEPATH] [--compiler COMMAND]
+ *
+ * The compiler command for the benchmark modules defaults to the one
+ * configured by CMake; the compiler must be able to find `csdl.h` and
+ * `cxx_invokable.hpp`.
+ */
+
+#include <csound.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if !defined(CXX_BENCH_OPCODE_LIBRARY)
+#define CXX_BENCH_OPCODE_LIBRARY "./libcsound_cxx.so"
+#endif
+#if !defined(CXX_BENCH_COMPILER_COMMAND)
+#define CXX_BENCH_COMPILER_COMMAND "g++ -O2 -fPIC -shared -std=c++17 -DUSE_DOUBLE -I/usr/local/include/csound -I."
+#endif
+
+static std::string opcode_library = CXX_BENCH_OPCODE_LIBRARY;
+static std::string compiler_command = CXX_BENCH_COMPILER_COMMAND;
+
+static double seconds_now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * The value of a measure that could not be taken, printed as null.
+ */
+static const double not_measured = std::numeric_limits<double>::quiet_NaN();
+
+static double median(std::vector<double> values) {
+    if (values.empty()) {
+        return not_measured;
+    }
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+/**
+ * The times of the phases of one Csound run, in seconds, and what Csound
+ * printed during the run.
+ */
+struct Run {
+    int result = 0;
+    // For compiling the orchestra, which runs its header (instr 0), and
+    // starting Csound.
+    double start_seconds = 0;
+    // For performing the score.
+    double perform_seconds = 0;
+    std::string messages;
+};
+
+static void collect_message(CSOUND *csound, int, const char *format, va_list arguments) {
+    auto run = static_cast<Run *>(csoundGetHostData(csound));
+    char buffer[0x1000];
+    std::vsnprintf(buffer, sizeof(buffer), format, arguments);
+    run->messages += buffer;
+}
+
+/**
+ * Init and performance errors in notes do not stop Csound, so a run also 
+ * fails if Csound printed one of these.
+ */
+static const char *error_markers[] = {"INIT ERROR", "PERF ERROR", "cxx_bench: error:", nullptr};
+
+static Run run_csound(const std::string &orchestra, const std::string &score) {
+    Run run;
+    CSOUND *csound = csoundCreate(&run);
+    csoundSetMessageCallback(csound, collect_message);
+    csoundSetOption(csound, "-n");
+    csoundSetOption(csound, "-d");
+    csoundSetOption(csound, "-m0");
+    auto opcode_lib_option = "--opcode-lib=" + opcode_library;
+    csoundSetOption(csound, opcode_lib_option.c_str());
+    auto start = seconds_now();
+    run.result = csoundCompileOrc(csound, orchestra.c_str());
+    if (run.result == 0) {
+        run.result = csoundReadScore(csound, score.c_str());
+    }
+    if (run.result == 0) {
+        run.result = csoundStart(csound);
+    }
+    run.start_seconds = seconds_now() - start;
+    if (run.result == 0) {
+        start = seconds_now();
+        int result;
+        while ((result = csoundPerformKsmps(csound)) == 0) {
+        }
+        run.perform_seconds = seconds_now() - start;
+        // A positive result is the end of the score.
+        if (result < 0) {
+            run.result = result;
+        }
+    }
+    csoundCleanup(csound);
+    csoundDestroy(csound);
+    for (auto marker = error_markers; run.result == 0 && *marker != nullptr; ++marker) {
+        if (run.messages.find(*marker) != std::string::npos) {
+            run.result = -1;
+        }
+    }
+    return run;
+}
+
+/**
+ * Returns true if the run failed. Then writes what Csound printed during the
+ * run to the standard error output, and if `error` is empty, sets it to a
+ * description of the failure.
+ */
+static bool failed(const Run &run, const std::string &description, std::string &error) {
+    if (run.result == 0) {
+        return false;
+    }
+    std::fprintf(stderr, "cxx_bench: %s failed (%d). Csound printed:\n%s\n", description.c_str(), run.result, run.messages.c_str());
+    if (error.empty()) {
+        error = description + " failed (" + std::to_string(run.result) + ")";
+    }
+    return true;
+}
+
+/**
+ * Returns the value as a JSON number, or null if it was not measured.
+ */
+static std::string json_number(double value, int precision) {
+    if (std::isnan(value)) {
+        return "null";
+    }
+    char buffer[0x100];
+    std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+    return buffer;
+}
+
+/**
+ * Returns the error as a JSON string, or null if there was none.
+ */
+static std::string json_error(const std::string &error) {
+    if (error.empty()) {
+        return "null";
+    }
+    std::string result = "\"";
+    for (auto c : error) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c < ' ' ? ' ' : c;
+    }
+    return result + "\"";
+}
+
+static const char *orchestra_header = R"(
+sr = 48000
+ksmps = 32
+nchnls = 1
+0dbfs = 1
+)";
+
+static const int ksmps = 32;
+static const double kr = 48000. / ksmps;
+
+/**
+ * Returns the source code of a benchmark module with the entry point
+ * `bench_main_<n>`, and the factories `bench_gain_<n>` (heap allocated,
+ * with virtual calls), `bench_placed_<n>` (placement constructed, with
+ * dispatch), and `bench_dispatch_<n>` (heap allocated, with dispatch). The
+ * nonce makes the source code, and so the cache key, unique.
+ */
+static std::string module_source(int n, const std::string &nonce = "") {
+    std::ostringstream stream;
+    stream << "// " << nonce << "\n"
+        "#include <csdl.h>\n"
+        "#include <cxx_invokable.hpp>\n"
+        "struct BenchGain" << n << " : public CxxInvokableBase {\n"
+        "    int init(CSOUND *csound, OPDS *opds, MYFLT **outputs, MYFLT **inputs) override {\n"
+        "        *outputs[0] = *inputs[0] * 0.5;\n"
+        "        return CxxInvokableBase::init(csound, opds, outputs, inputs);\n"
+        "    }\n"
+        "    int kontrol(CSOUND *csound, MYFLT **outputs, MYFLT **inputs) override {\n"
+        "        *outputs[0] = *inputs[0] * 0.5;\n"
+        "        return OK;\n"
+        "    }\n"
+        "};\n"
+        "extern \"C\" int bench_main_" << n << "(CSOUND *csound) {\n"
+        "    return OK;\n"
+        "}\n"
+        "extern \"C\" CxxInvokable *bench_gain_" << n << "() {\n"
+        "    return new BenchGain" << n << ";\n"
+        "}\n"
+        "CXX_PLACEMENT_FACTORY(bench_placed_" << n << ", BenchGain" << n << ")\n"
+        "CXX_REGISTER_INVOKABLE(bench_dispatch_" << n << ", BenchGain" << n << ")\n";
+    return stream.str();
+}
+
+/**
+ * Returns orchestra code that prints an error marker if `i_result` is not 0.
+ */
+static std::string check_statement(const std::string &result, const std::string &opcode) {
+    return "if " + result + " != 0 then\nprints \"cxx_bench: error: " + opcode + " failed\\n\"\nendif\n";
+}
+
+static std::string compile_statement(int n, const std::string &nonce = "") {
+    auto result = "i_result_" + std::to_string(n);
+    return result + " cxx_compile \"bench_main_" + std::to_string(n) + "\", {{" + module_source(n, nonce) + "}}, \"" + compiler_command + "\"\n" + check_statement(result, "cxx_compile");
+}
+
+static std::string declare_statements(int module_count) {
+    std::string statements;
+    for (int n = 0; n < module_count; ++n) {
+        statements += "cxx_compile_declare \"bench_main_" + std::to_string(n) + "\", {{" + module_source(n) + "}}, \"" + compiler_command + "\"\n";
+    }
+    statements += "i_result cxx_compile_all\n" + check_statement("i_result", "cxx_compile_all");
+    return statements;
+}
+
+/**
+ * Returns a score of `notes` notes of instr 2, each lasting one kperiod,
+ * `notes_per_kperiod` at a time.
+ */
+static std::string churn_score(int notes, int notes_per_kperiod) {
+    std::ostringstream stream;
+    stream.precision(12);
+    for (int note = 0; note < notes; ++note) {
+        stream << "i 2 " << (note / notes_per_kperiod) / kr << " " << 1 / kr << "\n";
+    }
+    return stream.str();
+}
+
+struct CompileResults {
+    double cold_seconds;
+    double cached_seconds;
+    double baseline_seconds;
+    std::string error;
+};
+
+/**
+ * Compile latency is the start time of an orchestra with one `cxx_compile`,
+ * less the start time of the same orchestra without it.
+ */
+static CompileResults bench_compile(int repetitions) {
+    std::vector<double> cold, cached, baseline;
+    std::string error;
+    auto score = "i 1 0 " + std::to_string(1 / kr) + "\n";
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+        auto nonce = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        auto orchestra = std::string(orchestra_header) + compile_statement(0, nonce) + "instr 1\nendin\n";
+        auto cold_run = run_csound(orchestra, score);
+        auto cached_run = run_csound(orchestra, score);
+        auto baseline_run = run_csound(std::string(orchestra_header) + "instr 1\nendin\n", score);
+        if (failed(cold_run, "cold compile", error) || failed(cached_run, "cached compile", error) || failed(baseline_run, "baseline start", error)) {
+            return {not_measured, not_measured, not_measured, error};
+        }
+        cold.push_back(cold_run.start_seconds);
+        cached.push_back(cached_run.start_seconds);
+        baseline.push_back(baseline_run.start_seconds);
+    }
+    auto baseline_ = median(baseline);
+    return {median(cold) - baseline_, median(cached) - baseline_, baseline_, error};
+}
+
+struct InitResult {
+    int modules;
+    double notes_per_second;
+};
+
+/**
+ * Init throughput is the number of one-kperiod `cxx_invoke` notes performed
+ * per second. The factory is in the last module loaded.
+ */
+static std::vector<InitResult> bench_init(const std::vector<int> &module_counts, int notes, std::string &error) {
+    std::vector<InitResult> results;
+    for (auto module_count : module_counts) {
+        auto factory = "bench_gain_" + std::to_string(module_count - 1);
+        auto orchestra = std::string(orchestra_header) + declare_statements(module_count) +
+            "instr 2\nk_out cxx_invoke \"" + factory + "\", 3, 1\nendin\n";
+        auto run = run_csound(orchestra, churn_score(notes, 64));
+        auto description = "init with " + std::to_string(module_count) + " modules";
+        results.push_back({module_count, failed(run, description, error) ? not_measured : notes / run.perform_seconds});
+    }
+    return results;
+}
+
+static double native_notes_per_second(int notes, std::string &error) {
+    auto orchestra = std::string(orchestra_header) + "instr 2\nk_out = 1 * 0.5\nendin\n";
+    auto run = run_csound(orchestra, churn_score(notes, 64));
+    return failed(run, "native init", error) ? not_measured : notes / run.perform_seconds;
+}
+
+/**
+ * Returns the performance time in nanoseconds per voice and kperiod of an
+ * instr 2 body with `voices` voices held for `kperiods` kperiods, less the
+ * time of an empty instr 2.
+ */
+static double voice_nanoseconds(const std::string &description, const std::string &preamble, const std::string &body, int voices, int kperiods, std::string &error) {
+    std::ostringstream score;
+    score.precision(12);
+    for (int voice = 0; voice < voices; ++voice) {
+        score << "i 2 0 " << kperiods / kr << " " << voice << "\n";
+    }
+    auto empty = run_csound(std::string(orchestra_header) + "instr 2\nendin\n", score.str());
+    auto run = run_csound(std::string(orchestra_header) + preamble + "instr 2\n" + body + "endin\n", score.str());
+    if (failed(empty, "empty kontrol", error) || failed(run, description, error)) {
+        return not_measured;
+    }
+    return (run.perform_seconds - empty.perform_seconds) * 1e9 / (double(voices) * kperiods);
+}
+
+int main(int argc, char *argv[]) {
+    bool quick = false;
+    for (int index = 1; index < argc; ++index) {
+        std::string argument = argv[index];
+        if (argument == "--quick") {
+            quick = true;
+        } else if (argument == "--opcode-lib" && index + 1 < argc) {
+            opcode_library = argv[++index];
+        } else if (argument == "--compiler" && index + 1 < argc) {
+            compiler_command = argv[++index];
+        } else {
+            std::fprintf(stderr, "Usage: cxx_bench [--quick] [--opcode-lib FILEPATH] [--compiler COMMAND]\n");
+            return 1;
+        }
+    }
+    // A private module cache, so that the cold and the cached cases are
+    // what they claim to be, and nothing is left behind.
+    auto cache_directory = std::filesystem::temp_directory_path() / ("cxx_bench_cache_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+#if defined(WIN32)
+    _putenv_s("CXX_OPCODES_CACHE_DIR", cache_directory.string().c_str());
+#else
+    setenv("CXX_OPCODES_CACHE_DIR", cache_directory.string().c_str(), 1);
+#endif
+    csoundInitialize(CSOUNDINIT_NO_SIGNAL_HANDLER | CSOUNDINIT_NO_ATEXIT);
+    int repetitions = quick ? 1 : 5;
+    int notes = quick ? 20000 : 200000;
+    int voices = quick ? 100 : 1000;
+    int kperiods = quick ? 1000 : 10000;
+    std::vector<int> module_counts = quick ? std::vector<int>{1, 4} : std::vector<int>{1, 4, 16, 64};
+
+    auto compile = bench_compile(repetitions);
+    std::string init_error;
+    auto init = bench_init(module_counts, notes, init_error);
+    auto native_throughput = native_notes_per_second(notes, init_error);
+    auto modules = declare_statements(1);
+    std::string kontrol_error;
+    auto native_voice = voice_nanoseconds("native kontrol", "", "k_out = p4 * 0.5\n", voices, kperiods, kontrol_error);
+    auto virtual_voice = voice_nanoseconds("virtual kontrol", modules, "k_out cxx_invoke \"bench_gain_0\", 3, p4\n", voices, kperiods, kontrol_error);
+    auto dispatch_voice = voice_nanoseconds("dispatch kontrol", modules, "k_out cxx_invoke \"bench_dispatch_0\", 3, p4\n", voices, kperiods, kontrol_error);
+    std::string churn_error;
+    auto churn = [&] (const std::string &factory) {
+        auto orchestra = std::string(orchestra_header) + modules + "instr 2\nk_out cxx_invoke \"" + factory + "\", 3, 1\nendin\n";
+        auto run = run_csound(orchestra, churn_score(notes, 64));
+        return failed(run, "note churn with " + factory, churn_error) ? not_measured : run.perform_seconds * 1e9 / notes;
+    };
+    // The native churn was measured with the init throughput.
+    auto native_churn = 1e9 / native_throughput;
+    auto heap_churn = churn("bench_gain_0");
+    auto placed_churn = churn("bench_placed_0");
+
+    std::error_code error_code;
+    std::filesystem::remove_all(cache_directory, error_code);
+
+    std::printf("{\n");
+    std::printf("  \"csound_version\": %d,\n", csoundGetVersion());
+    std::printf("  \"ksmps\": %d,\n", ksmps);
+    std::printf("  \"compile\": {\"repetitions\": %d, \"cold_seconds\": %s, \"cached_seconds\": %s, \"baseline_start_seconds\": %s, \"error\": %s},\n", repetitions, json_number(compile.cold_seconds, 6).c_str(), json_number(compile.cached_seconds, 6).c_str(), json_number(compile.baseline_seconds, 6).c_str(), json_error(compile.error).c_str());
+    std::printf("  \"init\": {\"notes\": %d, \"native_notes_per_second\": %s, \"cxx_invoke\": [", notes, json_number(native_throughput, 1).c_str());
+    for (size_t index = 0; index < init.size(); ++index) {
+        std::printf("%s{\"modules\": %d, \"notes_per_second\": %s}", index > 0 ? ", " : "", init[index].modules, json_number(init[index].notes_per_second, 1).c_str());
+    }
+    std::printf("], \"error\": %s},\n", json_error(init_error).c_str());
+    std::printf("  \"kontrol\": {\"voices\": %d, \"kperiods\": %d, \"native_ns_per_voice\": %s, \"virtual_ns_per_voice\": %s, \"dispatch_ns_per_voice\": %s, \"virtual_overhead_ns\": %s, \"dispatch_overhead_ns\": %s, \"error\": %s},\n", voices, kperiods, json_number(native_voice, 3).c_str(), json_number(virtual_voice, 3).c_str(), json_number(dispatch_voice, 3).c_str(), json_number(virtual_voice - native_voice, 3).c_str(), json_number(dispatch_voice - native_voice, 3).c_str(), json_error(kontrol_error).c_str());
+    std::printf("  \"note_churn\": {\"notes\": %d, \"native_ns_per_note\": %s, \"heap_ns_per_note\": %s, \"placement_ns_per_note\": %s, \"error\": %s}\n", notes, json_number(native_churn, 1).c_str(), json_number(heap_churn, 1).c_str(), json_number(placed_churn, 1).c_str(), json_error(churn_error).c_str());
+    std::printf("}\n");
+    bool any_failed = !compile.error.empty() || !init_error.empty() || !kontrol_error.empty() || !churn_error.empty();
+    return any_failed ? 1 : 0;
+}
@@ -21,12 +21,90 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
 */
 
 #include <csdl.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The version of the binary interface that this file defines between the 
+ * CXX opcodes and their modules, such as the layout of the `CxxInvokable` 
+ * vtable. It must be incremented whenever that interface changes. Every 
+ * module that includes this file exports the version, from 
+ * `cxx_invokable_interface_version`, and the opcodes refuse a module of 
+ * another version, and the factories of a module that does not export it, 
+ * e.g. a module compiled against an old copy of this file that comes first 
+ * on the include path.
+ */
+#define CXX_INVOKABLE_INTERFACE_VERSION 4
+
+extern "C" {
+    typedef int (*cxx_invokable_interface_version_t)();
+    /**
+     * Weak, so that every translation unit of a module may define it.
+     */
+#if defined(_MSC_VER)
+    __declspec(dllexport) inline int cxx_invokable_interface_version() {
+#else
+    __attribute__((weak, visibility("default"))) int cxx_invokable_interface_version() {
+#endif
+        return CXX_INVOKABLE_INTERFACE_VERSION;
+    }
+};
+
+/**
+ * Returns whether diagnostics are enabled for this module, that is, whether 
+ * its compiler command enabled debug messages for `cxx_invoke` (e.g. 
+ * `-+cxx_log=invoke:debug` or `-v`). `cxx_compile` sets this through 
+ * `cxx_set_module_diagnostics` after loading the module, and before calling 
+ * its entry point. Hidden, so that each module has its own; the modules of a 
+ * bundle share one. The flag is atomic because modules may read it on all 
+ * Csound threads.
+ */
+#if defined(_MSC_VER)
+inline std::atomic<bool> &cxx_module_diagnostics() {
+#else
+__attribute__((visibility("hidden"))) inline std::atomic<bool> &cxx_module_diagnostics() {
+#endif
+    static std::atomic<bool> enabled{false};
+    return enabled;
+}
+
+extern "C" {
+    typedef void (*cxx_set_module_diagnostics_t)(int enabled);
+    /**
+     * Exported, and weak like `cxx_invokable_interface_version`, so that the 
+     * opcodes can set the flag of each module that they load.
+     */
+#if defined(_MSC_VER)
+    __declspec(dllexport) inline void cxx_set_module_diagnostics(int enabled) {
+#else
+    __attribute__((weak, visibility("default"))) void cxx_set_module_diagnostics(int enabled) {
+#endif
+        cxx_module_diagnostics() = enabled != 0;
+    }
+};
 
 /**
  * Defines the pure abstract interface implemented by Cxx modules to be 
  * called by Csound using the `clang_invoke` opcode.
+ *
+ * Thread safety: when Csound runs with more than one thread (`-j`), 
+ * different instances may be created, initialized, performed, and turned 
+ * off at the same time on different threads, so factory functions may be 
+ * called concurrently. Each instance is only ever called by one thread at 
+ * a time. Any state that a module shares between instances (statics, 
+ * globals, caches) must therefore be made thread-safe by the module.
  */
 struct CxxInvokable {
 	virtual ~CxxInvokable() {};
@@ -51,6 +129,274 @@ struct CxxInvokable {
 	 * instance of the CxxInvokable is turned off.
 	 */
 	virtual int noteoff(CSOUND *csound) = 0;
+	/**
+	 * Called by `cxx_invoke` when it is finished with this instance, after 
+	 * `noteoff`. By default the instance is deleted; pooled instances 
+	 * instead return themselves to their pool (see `CxxInvokablePool`).
+	 */
+	virtual void release() {
+		delete this;
+	}
+	/**
+	 * Restores this instance to the state of a newly created instance, so 
+	 * that it can be reused for another note. Called before a pooled 
+	 * instance is returned to its pool.
+	 */
+	virtual void reset() {};
+	/**
+	 * Called by `cxx_invoke`, `cxx_invoke_array`, and `cxx_invoke_offload` 
+	 * before `init`, with the numbers of outputs and inputs that are 
+	 * actually passed to this instance, which are not always those of the 
+	 * invoking opcode.
+	 */
+	virtual void set_argument_counts(uint32_t output_count, uint32_t input_count) {};
+};
+
+/**
+ * The type of the factory functions, exported by modules with C linkage, 
+ * that `cxx_invoke` calls by name to create new `CxxInvokable` instances.
+ */
+extern "C" {
+    typedef CxxInvokable *(*cxx_invokable_factory_t)();
+};
+
+/**
+ * Optionally, a module may export a function named `cxx_invokable_factories`, 
+ * of type `cxx_invokable_factories_t`, that returns an array of the 
+ * factories defined in the module, terminated by an entry whose name is 
+ * nullptr. These factories are then registered as soon as the module is 
+ * loaded, and `cxx_invoke` never has to search the module for them:
+ * ```
+ * extern "C" const CxxFactoryEntry *cxx_invokable_factories() {
+ *     static const CxxFactoryEntry entries[] = {
+ *         {"reverb_factory", reverb_factory},
+ *         {nullptr, nullptr}
+ *     };
+ *     return entries;
+ * }
+ * ```
+ */
+struct CxxFactoryEntry {
+    const char *name;
+    cxx_invokable_factory_t factory;
+};
+
+extern "C" {
+    typedef const CxxFactoryEntry *(*cxx_invokable_factories_t)();
+};
+
+/**
+ * A library built ahead of time by the CMake function `cxx_opcodes_bundle` 
+ * contains several modules, and exports a function named 
+ * `cxx_bundle_entries`, of type `cxx_bundle_entries_t`, that returns the 
+ * entry point and the source code of each module, terminated by an entry 
+ * whose entry point is nullptr. `cxx_compile` uses a module from a bundle 
+ * that is listed in the environment variable `CXX_OPCODES_BUNDLE`, instead 
+ * of compiling it, if the entry point and the source code match. In a 
+ * bundle, each module's `cxx_invokable_factories` is named 
+ * `<entry point>_cxx_invokable_factories`.
+ */
+struct CxxBundleEntry {
+    const char *entry_point;
+    const char *source_code;
+};
+
+extern "C" {
+    typedef const CxxBundleEntry *(*cxx_bundle_entries_t)();
+    /**
+     * Also exported by a bundle, as `cxx_bundle_interface_version`: returns 
+     * the `CXX_INVOKABLE_INTERFACE_VERSION` that its modules were compiled 
+     * against. A bundle of another version is not used.
+     */
+    typedef int (*cxx_bundle_interface_version_t)();
+};
+
+/**
+ * A batch of numeric score events, stored as rows of `MYFLT` p-fields (p1 
+ * at index 0) in one preallocated array, that is sent to Csound by one call 
+ * of `submit`, without formatting or parsing any score text. Strings are not 
+ * supported as p-fields.
+ *
+ * `submit` must be called by the thread that is performing the Csound 
+ * instance, i.e. from `init`, `kontrol`, `noteoff`, or a module's entry 
+ * point; start times are relative to the current time, as for the `event` 
+ * opcode. Once `reserve` has been called with enough capacity, appending and 
+ * submitting do not allocate, so a batch can also be filled and submitted 
+ * from `kontrol`.
+ *
+ * ```
+ * CxxScoreBatch batch(5, notes.size());
+ * for (const auto &note : notes) {
+ *     batch.append({1., note.time, note.duration, note.key, note.velocity});
+ * }
+ * batch.submit(csound);
+ * ```
+ */
+class CxxScoreBatch {
+    public:
+        explicit CxxScoreBatch(size_t pfields_per_event = 3, size_t capacity = 0) {
+            reserve(pfields_per_event, capacity);
+        }
+        /**
+         * Sets the number of p-fields of every event (if the batch is 
+         * empty), and preallocates room for `capacity` events.
+         */
+        void reserve(size_t pfields_per_event, size_t capacity) {
+            if (empty()) {
+                pfields = std::max(size_t(3), std::min(pfields_per_event, size_t(PMAX)));
+            }
+            values.reserve(capacity * pfields);
+            opcodes.reserve(capacity);
+            order.reserve(capacity);
+            if (event == nullptr) {
+                event.reset(new EVTBLK());
+            }
+        }
+        size_t pfield_count() const {
+            return pfields;
+        }
+        size_t size() const {
+            return opcodes.size();
+        }
+        bool empty() const {
+            return opcodes.empty();
+        }
+        void clear() {
+            values.clear();
+            opcodes.clear();
+        }
+        /**
+         * Appends an event of type `opcode` ('i', 'f', 'e', ...), and returns 
+         * its p-fields, zeroed, for the caller to fill in.
+         */
+        MYFLT *append(char opcode = 'i') {
+            opcodes.push_back(opcode);
+            values.resize(values.size() + pfields, MYFLT(0));
+            return values.data() + values.size() - pfields;
+        }
+        /**
+         * Appends an event with the given p-fields, starting with p1; 
+         * missing p-fields are 0, and extra ones are ignored.
+         */
+        void append(std::initializer_list<MYFLT> pfields_, char opcode = 'i') {
+            auto row = append(opcode);
+            std::copy_n(pfields_.begin(), std::min(pfields_.size(), pfields), row);
+        }
+        /**
+         * Sends all events to Csound and empties the batch. Returns the 
+         * number of events that Csound accepted.
+         *
+         * Csound keeps pending events in a list sorted by start time, and 
+         * inserts each event after all events that start no later; the 
+         * events are therefore inserted latest first, so that a batch in 
+         * time order does not take time quadratic in its size.
+         */
+        int submit(CSOUND *csound) {
+            if (empty()) {
+                return 0;
+            }
+            if (event == nullptr) {
+                event.reset(new EVTBLK());
+            }
+            order.resize(size());
+            for (size_t index = 0; index < order.size(); ++index) {
+                order[index] = index;
+            }
+            auto start = [this](size_t index) {
+                return pfields > 1 ? values[index * pfields + 1] : MYFLT(0);
+            };
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                if (start(a) != start(b)) {
+                    return start(a) > start(b);
+                }
+                return a < b;
+            });
+            auto now = csound->GetCurrentTimeSamples(csound);
+            int accepted = 0;
+            for (auto index : order) {
+                const MYFLT *row = values.data() + index * pfields;
+                event->strarg = nullptr;
+                event->scnt = 0;
+                event->opcod = opcodes[index];
+                event->pcnt = (int16) pfields;
+                event->p[0] = MYFLT(0);
+                std::copy_n(row, pfields, &event->p[1]);
+                event->p2orig = event->p[2];
+                event->p3orig = event->p[3];
+                if (csound->insert_score_event_at_sample(csound, event.get(), now) == 0) {
+                    accepted += 1;
+                }
+            }
+            clear();
+            return accepted;
+        }
+    private:
+        size_t pfields = 3;
+        std::vector<MYFLT> values;
+        std::vector<char> opcodes;
+        std::vector<size_t> order;
+        // EVTBLK has room for PMAX p-fields, so it is allocated once.
+        std::unique_ptr<EVTBLK> event;
+};
+
+/**
+ * A view, without copying, of elements of type `T` in memory that belongs 
+ * to someone else, such as a Csound function table (see 
+ * `CxxInvokableBase::table`) or a memory-mapped file (see 
+ * `CxxMappedFile`). Elements may be interleaved in `channels`. Indexing 
+ * with `[]` is not checked; `at` returns `T()` for an index that is out of 
+ * bounds, and `clamped` returns the nearest element.
+ */
+template <typename T>
+struct CxxTableSpan {
+    T *data = nullptr;
+    size_t size = 0;
+    size_t channels = 1;
+    bool empty() const {
+        return size == 0;
+    }
+    T *begin() const {
+        return data;
+    }
+    T *end() const {
+        return data + size;
+    }
+    T &operator[](size_t index) const {
+        return data[index];
+    }
+    T at(ptrdiff_t index) const {
+        if (index < 0 || size_t(index) >= size) {
+            return T();
+        }
+        return data[index];
+    }
+    T clamped(ptrdiff_t index) const {
+        if (size == 0) {
+            return T();
+        }
+        return data[std::min<ptrdiff_t>(std::max<ptrdiff_t>(index, 0), size - 1)];
+    }
+    size_t frames() const {
+        return channels == 0 ? 0 : size / channels;
+    }
+    /**
+     * Returns the `channels` elements of a frame, or nullptr if the frame 
+     * is out of bounds.
+     */
+    T *frame(size_t index) const {
+        if (index >= frames()) {
+            return nullptr;
+        }
+        return data + index * channels;
+    }
+    /**
+     * Returns the elements from `offset`, at most `count` of them, within 
+     * bounds.
+     */
+    CxxTableSpan subspan(size_t offset, size_t count = size_t(-1)) const {
+        offset = std::min(offset, size);
+        return {data + offset, std::min(count, size - offset), channels};
+    }
 };
 
 /**
@@ -62,6 +408,14 @@ class CxxInvokableBase : public CxxInvokable {
     public:
         virtual ~CxxInvokableBase() {
         };
+        void reset() override {
+            opds = nullptr;
+            csound = nullptr;
+        }
+        void set_argument_counts(uint32_t output_count, uint32_t input_count) override {
+            output_arg_count_ = output_count;
+            input_arg_count_ = input_count;
+        }
         int init(CSOUND *csound_, OPDS *opds_, MYFLT **outputs, MYFLT **inputs) override {
             int result = OK;
             csound = csound_;
@@ -102,20 +456,68 @@ class CxxInvokableBase : public CxxInvokable {
             }
             return opds->insdshead->ksmps;
         }
-        uint32_t output_arg_count()
+        /**
+         * Returns the number of outputs that are passed to this instance.
+         */
+        uint32_t output_arg_count() const
         {
-            if (opds == nullptr) {
-                return -0;
+            return output_arg_count_;
+        }
+        /**
+         * Returns the number of inputs that are passed to this instance, 
+         * not counting the inputs that belong to the invoking opcode.
+         */
+        uint32_t input_arg_count() const
+        {
+            return input_arg_count_;
+        }
+        /**
+         * Returns a view of the function table whose number is `*number`, 
+         * usually an input argument, or an empty view if there is no such 
+         * table. The view has `flen` elements and the table's number of 
+         * channels, and remains valid as long as the table is not replaced 
+         * or freed; it is meant to be taken at init time.
+         */
+        CxxTableSpan<MYFLT> table(MYFLT *number) const
+        {
+            CxxTableSpan<MYFLT> span;
+            if (csound == nullptr || number == nullptr) {
+                return span;
+            }
+            auto function = csound->FTnp2Find(csound, number);
+            if (function != nullptr && function->ftable != nullptr) {
+                span.data = function->ftable;
+                span.size = function->flen;
+                span.channels = std::max<int32_t>(function->nchanls, 1);
             }
-            return (uint32_t)opds->optext->t.outArgCount;
+            return span;
         }
-        uint32_t input_arg_count()
+        CxxTableSpan<MYFLT> table(int number) const
         {
-            if (opds == nullptr) {
-                return- 0;
+            MYFLT number_ = number;
+            return table(&number_);
+        }
+        /**
+         * As `table`, but views the table as elements of type `T`, which 
+         * must consist of whole `MYFLT` values, e.g. a struct of two `MYFLT` 
+         * for a table of interleaved stereo frames or of complex numbers.
+         */
+        template <typename T>
+        CxxTableSpan<T> table_as(MYFLT *number) const
+        {
+            static_assert(sizeof(T) % sizeof(MYFLT) == 0 && alignof(T) <= alignof(MYFLT), "The type must consist of whole MYFLT values.");
+            auto span = table(number);
+            return {reinterpret_cast<T *>(span.data), span.size * sizeof(MYFLT) / sizeof(T), 1};
+        }
+        /**
+         * Sends `batch` to the Csound instance that is invoking this object.
+         */
+        int submit(CxxScoreBatch &batch)
+        {
+            if (csound == nullptr) {
+                return 0;
             }
-            // The first two input arguments belong to the invoking opcode.
-            return (uint32_t)opds->optext->t.inArgCount - 2;
+            return batch.submit(csound);
         }
         void log(const char *format,...)
         {
@@ -153,4 +555,1578 @@ class CxxInvokableBase : public CxxInvokable {
     protected:
         OPDS *opds = nullptr;
         CSOUND *csound = nullptr;
+        uint32_t output_arg_count_ = 0;
+        uint32_t input_arg_count_ = 0;
+};
+
+#if defined(_MSC_VER)
+#define CXX_RESTRICT __restrict
+#else
+#define CXX_RESTRICT __restrict__
+#endif
+
+/**
+ * Alignment in bytes of `CxxAlignedBuffer`, and of the channel buffers that 
+ * `CxxAudioInvokable` provides when aligned buffers are requested; enough 
+ * for AVX-512.
+ */
+static constexpr size_t CXX_AUDIO_ALIGNMENT = 64;
+
+/**
+ * A non-aliasing view of `size` samples. Kernels that take spans may assume 
+ * that no two spans passed to them overlap.
+ */
+struct CxxSpan {
+    MYFLT *CXX_RESTRICT data;
+    size_t size;
+    MYFLT &operator[](size_t index) const {
+        return data[index];
+    }
+};
+
+struct CxxConstSpan {
+    const MYFLT *CXX_RESTRICT data;
+    size_t size;
+    CxxConstSpan(const MYFLT *data_, size_t size_) : data(data_), size(size_) {}
+    CxxConstSpan(const CxxSpan &span) : data(span.data), size(span.size) {}
+    const MYFLT &operator[](size_t index) const {
+        return data[index];
+    }
+};
+
+/**
+ * A view of the a[] or k[] array that `cxx_invoke_array` passes as 
+ * `outputs[0]` or `inputs[0]`: `channels` signals of `frames` samples each, 
+ * stored channel after channel. For a[] arrays `frames` is `ksmps`, for 
+ * k[] arrays it is 1.
+ */
+struct CxxChannelMatrix {
+    MYFLT *data = nullptr;
+    size_t channels = 0;
+    size_t frames = 0;
+    MYFLT *channel(size_t index) const {
+        return data + index * frames;
+    }
+    CxxSpan span(size_t index) const {
+        return CxxSpan{channel(index), frames};
+    }
+    MYFLT &operator()(size_t channel, size_t frame) const {
+        return data[channel * frames + frame];
+    }
+};
+
+static inline CxxChannelMatrix cxx_channel_matrix(MYFLT *argument) {
+    CxxChannelMatrix matrix;
+    auto array = (ARRAYDAT *) argument;
+    if (array == nullptr || array->data == nullptr || array->sizes == nullptr) {
+        return matrix;
+    }
+    matrix.data = array->data;
+    matrix.channels = array->sizes[0];
+    matrix.frames = array->arrayMemberSize / sizeof(MYFLT);
+    return matrix;
+}
+
+/**
+ * A zeroed scratch buffer of samples aligned to `CXX_AUDIO_ALIGNMENT`, 
+ * typically sized to `ksmps` (times a number of channels) at init time so 
+ * that `kontrol` never allocates.
+ */
+class CxxAlignedBuffer {
+    public:
+        CxxAlignedBuffer() {}
+        explicit CxxAlignedBuffer(size_t size_) {
+            resize(size_);
+        }
+        CxxAlignedBuffer(const CxxAlignedBuffer &) = delete;
+        CxxAlignedBuffer &operator=(const CxxAlignedBuffer &) = delete;
+        ~CxxAlignedBuffer() {
+            release();
+        }
+        /**
+         * Reallocates only if the size changes; in any case, zeroes the 
+         * buffer.
+         */
+        void resize(size_t size_) {
+            if (size_ != size) {
+                release();
+                if (size_ > 0) {
+                    data = static_cast<MYFLT *>(::operator new(size_ * sizeof(MYFLT), std::align_val_t(CXX_AUDIO_ALIGNMENT)));
+                }
+                size = size_;
+            }
+            if (data != nullptr) {
+                std::memset(data, 0, size * sizeof(MYFLT));
+            }
+        }
+        MYFLT *get() const {
+            return data;
+        }
+        size_t get_size() const {
+            return size;
+        }
+        CxxSpan span() const {
+            return {data, size};
+        }
+        MYFLT &operator[](size_t index) const {
+            return data[index];
+        }
+    private:
+        void release() {
+            if (data != nullptr) {
+                ::operator delete(data, std::align_val_t(CXX_AUDIO_ALIGNMENT));
+                data = nullptr;
+            }
+            size = 0;
+        }
+        MYFLT *data = nullptr;
+        size_t size = 0;
 };
+
+/**
+ * The vector instructions used by the kernels below, chosen at compile time 
+ * from the target's instruction set (add e.g. `-mavx2` or `-march=native` 
+ * to the compiler command) and the precision of `MYFLT`. If no vector 
+ * instruction set is available, only the scalar loops are used.
+ */
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace cxx_simd {
+#if defined(__AVX__) && defined(USE_DOUBLE)
+    typedef __m256d vector;
+    static constexpr size_t lanes = 4;
+    inline vector load(const MYFLT *p) { return _mm256_loadu_pd(p); }
+    inline void store(MYFLT *p, vector v) { _mm256_storeu_pd(p, v); }
+    inline vector set1(MYFLT x) { return _mm256_set1_pd(x); }
+    inline vector add(vector a, vector b) { return _mm256_add_pd(a, b); }
+    inline vector mul(vector a, vector b) { return _mm256_mul_pd(a, b); }
+    inline vector flush(vector v, vector minimum) {
+        vector magnitude = _mm256_andnot_pd(_mm256_set1_pd(-0.), v);
+        return _mm256_and_pd(v, _mm256_cmp_pd(magnitude, minimum, _CMP_GE_OQ));
+    }
+#elif defined(__AVX__)
+    typedef __m256 vector;
+    static constexpr size_t lanes = 8;
+    inline vector load(const MYFLT *p) { return _mm256_loadu_ps(p); }
+    inline void store(MYFLT *p, vector v) { _mm256_storeu_ps(p, v); }
+    inline vector set1(MYFLT x) { return _mm256_set1_ps(x); }
+    inline vector add(vector a, vector b) { return _mm256_add_ps(a, b); }
+    inline vector mul(vector a, vector b) { return _mm256_mul_ps(a, b); }
+    inline vector flush(vector v, vector minimum) {
+        vector magnitude = _mm256_andnot_ps(_mm256_set1_ps(-0.f), v);
+        return _mm256_and_ps(v, _mm256_cmp_ps(magnitude, minimum, _CMP_GE_OQ));
+    }
+#elif (defined(__SSE2__) || defined(_M_X64)) && defined(USE_DOUBLE)
+    typedef __m128d vector;
+    static constexpr size_t lanes = 2;
+    inline vector load(const MYFLT *p) { return _mm_loadu_pd(p); }
+    inline void store(MYFLT *p, vector v) { _mm_storeu_pd(p, v); }
+    inline vector set1(MYFLT x) { return _mm_set1_pd(x); }
+    inline vector add(vector a, vector b) { return _mm_add_pd(a, b); }
+    inline vector mul(vector a, vector b) { return _mm_mul_pd(a, b); }
+    inline vector flush(vector v, vector minimum) {
+        vector magnitude = _mm_andnot_pd(_mm_set1_pd(-0.), v);
+        return _mm_and_pd(v, _mm_cmpge_pd(magnitude, minimum));
+    }
+#elif (defined(__SSE__) || defined(_M_X64)) && !defined(USE_DOUBLE)
+    typedef __m128 vector;
+    static constexpr size_t lanes = 4;
+    inline vector load(const MYFLT *p) { return _mm_loadu_ps(p); }
+    inline void store(MYFLT *p, vector v) { _mm_storeu_ps(p, v); }
+    inline vector set1(MYFLT x) { return _mm_set1_ps(x); }
+    inline vector add(vector a, vector b) { return _mm_add_ps(a, b); }
+    inline vector mul(vector a, vector b) { return _mm_mul_ps(a, b); }
+    inline vector flush(vector v, vector minimum) {
+        vector magnitude = _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+        return _mm_and_ps(v, _mm_cmpge_ps(magnitude, minimum));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__) && defined(USE_DOUBLE)
+    typedef float64x2_t vector;
+    static constexpr size_t lanes = 2;
+    inline vector load(const MYFLT *p) { return vld1q_f64(p); }
+    inline void store(MYFLT *p, vector v) { vst1q_f64(p, v); }
+    inline vector set1(MYFLT x) { return vdupq_n_f64(x); }
+    inline vector add(vector a, vector b) { return vaddq_f64(a, b); }
+    inline vector mul(vector a, vector b) { return vmulq_f64(a, b); }
+    inline vector flush(vector v, vector minimum) {
+        uint64x2_t mask = vcgeq_f64(vabsq_f64(v), minimum);
+        return vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(v), mask));
+    }
+#elif defined(__ARM_NEON) && !defined(USE_DOUBLE)
+    typedef float32x4_t vector;
+    static constexpr size_t lanes = 4;
+    inline vector load(const MYFLT *p) { return vld1q_f32(p); }
+    inline void store(MYFLT *p, vector v) { vst1q_f32(p, v); }
+    inline vector set1(MYFLT x) { return vdupq_n_f32(x); }
+    inline vector add(vector a, vector b) { return vaddq_f32(a, b); }
+    inline vector mul(vector a, vector b) { return vmulq_f32(a, b); }
+    inline vector flush(vector v, vector minimum) {
+        uint32x4_t mask = vcgeq_f32(vabsq_f32(v), minimum);
+        return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), mask));
+    }
+#else
+#define CXX_SIMD_SCALAR_ONLY
+    static constexpr size_t lanes = 1;
+#endif
+    /**
+     * The smallest normal `MYFLT`; smaller magnitudes are flushed to zero.
+     */
+    static constexpr MYFLT normal_minimum = sizeof(MYFLT) == sizeof(double) ? MYFLT(2.2250738585072014e-308) : MYFLT(1.17549435e-38f);
+}
+
+/**
+ * out = in * gain.
+ */
+inline void cxx_gain(MYFLT *CXX_RESTRICT out, const MYFLT *CXX_RESTRICT in, MYFLT gain, size_t frames) {
+    size_t index = 0;
+#if !defined(CXX_SIMD_SCALAR_ONLY)
+    auto gain_ = cxx_simd::set1(gain);
+    for ( ; index + cxx_simd::lanes <= frames; index += cxx_simd::lanes) {
+        cxx_simd::store(out + index, cxx_simd::mul(cxx_simd::load(in + index), gain_));
+    }
+#endif
+    for ( ; index < frames; ++index) {
+        out[index] = in[index] * gain;
+    }
+}
+
+/**
+ * buffer *= gain, in place.
+ */
+inline void cxx_gain(MYFLT *CXX_RESTRICT buffer, MYFLT gain, size_t frames) {
+    size_t index = 0;
+#if !defined(CXX_SIMD_SCALAR_ONLY)
+    auto gain_ = cxx_simd::set1(gain);
+    for ( ; index + cxx_simd::lanes <= frames; index += cxx_simd::lanes) {
+        cxx_simd::store(buffer + index, cxx_simd::mul(cxx_simd::load(buffer + index), gain_));
+    }
+#endif
+    for ( ; index < frames; ++index) {
+        buffer[index] *= gain;
+    }
+}
+
+/**
+ * out += in * gain.
+ */
+inline void cxx_mix(MYFLT *CXX_RESTRICT out, const MYFLT *CXX_RESTRICT in, MYFLT gain, size_t frames) {
+    size_t index = 0;
+#if !defined(CXX_SIMD_SCALAR_ONLY)
+    auto gain_ = cxx_simd::set1(gain);
+    for ( ; index + cxx_simd::lanes <= frames; index += cxx_simd::lanes) {
+        auto product = cxx_simd::mul(cxx_simd::load(in + index), gain_);
+        cxx_simd::store(out + index, cxx_simd::add(cxx_simd::load(out + index), product));
+    }
+#endif
+    for ( ; index < frames; ++index) {
+        out[index] += in[index] * gain;
+    }
+}
+
+/**
+ * Equal power pan of a mono input to stereo outputs, where pan 0 is hard 
+ * left and 1 is hard right.
+ */
+inline void cxx_pan(MYFLT *CXX_RESTRICT left, MYFLT *CXX_RESTRICT right, const MYFLT *CXX_RESTRICT in, MYFLT pan, size_t frames) {
+    MYFLT angle = pan * MYFLT(1.5707963267948966);
+    cxx_gain(left, in, std::cos(angle), frames);
+    cxx_gain(right, in, std::sin(angle), frames);
+}
+
+/**
+ * Sets samples whose magnitude is subnormal to zero, in place. Recursive 
+ * filters and reverbs that decay into subnormal numbers can otherwise run 
+ * many times slower.
+ */
+inline void cxx_flush_denormals(MYFLT *CXX_RESTRICT buffer, size_t frames) {
+    size_t index = 0;
+#if !defined(CXX_SIMD_SCALAR_ONLY)
+    auto minimum = cxx_simd::set1(cxx_simd::normal_minimum);
+    for ( ; index + cxx_simd::lanes <= frames; index += cxx_simd::lanes) {
+        cxx_simd::store(buffer + index, cxx_simd::flush(cxx_simd::load(buffer + index), minimum));
+    }
+#endif
+    for ( ; index < frames; ++index) {
+        if (std::fabs(buffer[index]) < cxx_simd::normal_minimum) {
+            buffer[index] = 0;
+        }
+    }
+}
+
+/**
+ * Span versions of the kernels; all spans must have the same size.
+ */
+inline void cxx_gain(CxxSpan out, CxxConstSpan in, MYFLT gain) {
+    cxx_gain(out.data, in.data, gain, out.size);
+}
+
+inline void cxx_gain(CxxSpan buffer, MYFLT gain) {
+    cxx_gain(buffer.data, gain, buffer.size);
+}
+
+inline void cxx_mix(CxxSpan out, CxxConstSpan in, MYFLT gain) {
+    cxx_mix(out.data, in.data, gain, out.size);
+}
+
+inline void cxx_pan(CxxSpan left, CxxSpan right, CxxConstSpan in, MYFLT pan) {
+    cxx_pan(left.data, right.data, in.data, pan, in.size);
+}
+
+inline void cxx_flush_denormals(CxxSpan buffer) {
+    cxx_flush_denormals(buffer.data, buffer.size);
+}
+
+/**
+ * The type of an argument of `cxx_invoke`, as given by the Csound type 
+ * system for the argument's variable.
+ */
+enum class CxxArgumentType {
+    AUDIO,
+    CONTROL,
+    INIT,
+    STRING,
+    ARRAY,
+    OTHER
+};
+
+inline CxxArgumentType cxx_argument_type(CSOUND *csound, void *argument) {
+    auto type = csound->GetTypeForArg(argument);
+    if (type == nullptr || type->varTypeName == nullptr) {
+        return CxxArgumentType::OTHER;
+    }
+    switch (type->varTypeName[0]) {
+        case 'a':
+            return CxxArgumentType::AUDIO;
+        case 'k':
+            return CxxArgumentType::CONTROL;
+        case 'i':
+        case 'c':
+        case 'r':
+        case 'p':
+            return CxxArgumentType::INIT;
+        case 'S':
+            return CxxArgumentType::STRING;
+        case '[':
+            return CxxArgumentType::ARRAY;
+        default:
+            return CxxArgumentType::OTHER;
+    }
+}
+
+/**
+ * A view of the audio rate inputs, or outputs, of a `CxxAudioInvokable` for 
+ * one kperiod. Each channel is a contiguous span of `frames()` samples. Only 
+ * the samples from `begin()` up to `end()` need be processed; the output 
+ * samples outside that range are set to zero by `CxxAudioInvokable`, so 
+ * that processing loops need no per-sample branches.
+ */
+class AudioBlock {
+    public:
+        size_t channels() const {
+            return channels_.size();
+        }
+        size_t frames() const {
+            return frames_;
+        }
+        size_t begin() const {
+            return begin_;
+        }
+        size_t end() const {
+            return end_;
+        }
+        MYFLT *channel(size_t index) const {
+            return channels_[index];
+        }
+        MYFLT *operator[](size_t index) const {
+            return channels_[index];
+        }
+        /**
+         * Returns the samples of a channel from `begin()` up to `end()`.
+         */
+        CxxSpan span(size_t index) const {
+            return {channels_[index] + begin_, end_ - begin_};
+        }
+    protected:
+        friend class CxxAudioInvokable;
+        std::vector<MYFLT *> channels_;
+        size_t frames_ = 0;
+        size_t begin_ = 0;
+        size_t end_ = 0;
+};
+
+/**
+ * Base class for invokables that process audio in blocks. At init time, the 
+ * arguments of `cxx_invoke` are classified by type. The audio rate inputs 
+ * and outputs are presented to `process` as `AudioBlock`s, and all other 
+ * arguments remain available by index. Derived classes that override `init` 
+ * must call `CxxAudioInvokable::init` first.
+ *
+ * If `use_aligned_buffers(true)` is called before `CxxAudioInvokable::init`, 
+ * the channels are copied into, and out of, buffers that are aligned to 
+ * `CXX_AUDIO_ALIGNMENT` and contiguous in memory, so that the compiler can 
+ * use aligned vector loads and stores; otherwise the channels are Csound's 
+ * own signal buffers, and there is no copying.
+ */
+class CxxAudioInvokable : public CxxInvokableBase {
+    public:
+        int init(CSOUND *csound_, OPDS *opds_, MYFLT **outputs, MYFLT **inputs) override {
+            int result = CxxInvokableBase::init(csound_, opds_, outputs, inputs);
+            input_types.clear();
+            output_types.clear();
+            input_arguments.clear();
+            output_arguments.clear();
+            audio_inputs.channels_.clear();
+            audio_outputs.channels_.clear();
+            for (uint32_t index = 0; index < input_arg_count(); ++index) {
+                input_types.push_back(cxx_argument_type(csound, inputs[index]));
+                input_arguments.push_back(inputs[index]);
+                if (input_types.back() == CxxArgumentType::AUDIO) {
+                    audio_inputs.channels_.push_back(inputs[index]);
+                }
+            }
+            for (uint32_t index = 0; index < output_arg_count(); ++index) {
+                output_types.push_back(cxx_argument_type(csound, outputs[index]));
+                output_arguments.push_back(outputs[index]);
+                if (output_types.back() == CxxArgumentType::AUDIO) {
+                    audio_outputs.channels_.push_back(outputs[index]);
+                }
+            }
+            audio_inputs.frames_ = audio_outputs.frames_ = ksmps();
+            if (aligned) {
+                aligned_buffers.resize((audio_inputs.channels() + audio_outputs.channels()) * aligned_stride());
+            } else {
+                aligned_buffers.resize(0);
+            }
+            return result;
+        }
+        /**
+         * Called once per kperiod with the audio rate inputs and outputs. 
+         * Process the frames from `in.begin()` up to `in.end()`.
+         */
+        virtual int process(const AudioBlock &in, AudioBlock &out) = 0;
+        int kontrol(CSOUND *csound_, MYFLT **outputs, MYFLT **inputs) override final {
+            // The arguments are bound again in every kperiod, because they 
+            // need not be the buffers that were passed to `init` (e.g. in 
+            // `cxx_invoke_offload`, they are blocks of its rings).
+            bind_arguments(outputs, inputs);
+            size_t begin = kperiodOffset();
+            size_t end = kperiodEnd();
+            audio_inputs.begin_ = audio_outputs.begin_ = begin;
+            audio_inputs.end_ = audio_outputs.end_ = end;
+            if (aligned_buffers.get() == nullptr) {
+                int result = process(audio_inputs, audio_outputs);
+                zero_outside(audio_outputs, begin, end);
+                return result;
+            }
+            // Swap the aligned buffers in for Csound's buffers.
+            size_t stride = aligned_stride();
+            size_t frames = ksmps();
+            MYFLT *buffer = aligned_buffers.get();
+            for (auto &channel : audio_inputs.channels_) {
+                std::memcpy(buffer, channel, frames * sizeof(MYFLT));
+                channel = buffer;
+                buffer += stride;
+            }
+            for (auto &channel : audio_outputs.channels_) {
+                channel = buffer;
+                buffer += stride;
+            }
+            int result = process(audio_inputs, audio_outputs);
+            zero_outside(audio_outputs, begin, end);
+            size_t audio_output_index = 0;
+            for (size_t index = 0; index < output_arguments.size(); ++index) {
+                if (output_types[index] == CxxArgumentType::AUDIO) {
+                    std::memcpy(output_arguments[index], audio_outputs.channels_[audio_output_index++], frames * sizeof(MYFLT));
+                }
+            }
+            return result;
+        }
+        /**
+         * Requests, or not, aligned and contiguous channel buffers. Must be 
+         * called before `CxxAudioInvokable::init`.
+         */
+        void use_aligned_buffers(bool enabled) {
+            aligned = enabled;
+        }
+        CxxArgumentType input_type(size_t index) const {
+            return input_types[index];
+        }
+        CxxArgumentType output_type(size_t index) const {
+            return output_types[index];
+        }
+        /**
+         * Returns the argument as given to `cxx_invoke`, which may be of 
+         * any type.
+         */
+        MYFLT *input(size_t index) const {
+            return input_arguments[index];
+        }
+        MYFLT *output(size_t index) const {
+            return output_arguments[index];
+        }
+    protected:
+        void bind_arguments(MYFLT **outputs, MYFLT **inputs) {
+            size_t audio_index = 0;
+            for (size_t index = 0; index < input_arguments.size(); ++index) {
+                input_arguments[index] = inputs[index];
+                if (input_types[index] == CxxArgumentType::AUDIO) {
+                    audio_inputs.channels_[audio_index++] = inputs[index];
+                }
+            }
+            audio_index = 0;
+            for (size_t index = 0; index < output_arguments.size(); ++index) {
+                output_arguments[index] = outputs[index];
+                if (output_types[index] == CxxArgumentType::AUDIO) {
+                    audio_outputs.channels_[audio_index++] = outputs[index];
+                }
+            }
+        }
+        static void zero_outside(AudioBlock &block, size_t begin, size_t end) {
+            for (size_t channel = 0; channel < block.channels(); ++channel) {
+                MYFLT *samples = block.channel(channel);
+                if (begin > 0) {
+                    std::memset(samples, 0, begin * sizeof(MYFLT));
+                }
+                if (end < block.frames()) {
+                    std::memset(samples + end, 0, (block.frames() - end) * sizeof(MYFLT));
+                }
+            }
+        }
+        size_t aligned_stride() const {
+            size_t per_line = CXX_AUDIO_ALIGNMENT / sizeof(MYFLT);
+            return ((ksmps() + per_line - 1) / per_line) * per_line;
+        }
+        AudioBlock audio_inputs;
+        AudioBlock audio_outputs;
+        std::vector<CxxArgumentType> input_types;
+        std::vector<CxxArgumentType> output_types;
+        std::vector<MYFLT *> input_arguments;
+        std::vector<MYFLT *> output_arguments;
+        CxxAlignedBuffer aligned_buffers;
+        bool aligned = false;
+};
+
+/**
+ * A per-factory free list of instances of `T`, so that short notes can 
+ * reuse instances instead of allocating and freeing them on Csound's 
+ * performance threads. `T` must derive from `CxxPooledInvokable<T>`, and 
+ * should override `reset` to restore any state that a new note expects. 
+ * The factory then acquires instances from the pool:
+ * ```
+ * struct Grain : public CxxPooledInvokable<Grain> { ... };
+ * extern "C" CxxInvokable *grain_factory() {
+ *     return CxxInvokablePool<Grain>::instance().acquire();
+ * }
+ * ```
+ * Calling `reserve` at init time, e.g. from the module's entry point, 
+ * ensures that in the steady state no note allocates at all. The pool is 
+ * thread-safe; it is guarded by a spinlock that is only held to push or 
+ * pop one instance.
+ */
+template <typename T>
+class CxxInvokablePool {
+    public:
+        static CxxInvokablePool &instance() {
+            static CxxInvokablePool pool;
+            return pool;
+        }
+        ~CxxInvokablePool() {
+            while (free_list != nullptr) {
+                auto next = free_list->next_free;
+                delete free_list;
+                free_list = next;
+            }
+        }
+        /**
+         * Returns a free instance, or a new one if there are none.
+         */
+        T *acquire() {
+            lock();
+            T *result = free_list;
+            if (result != nullptr) {
+                free_list = result->next_free;
+            }
+            unlock();
+            if (result == nullptr) {
+                result = new T;
+            }
+            result->next_free = nullptr;
+            return result;
+        }
+        /**
+         * Resets an instance, and returns it to the free list.
+         */
+        void recycle(T *instance_) {
+            instance_->reset();
+            lock();
+            instance_->next_free = free_list;
+            free_list = instance_;
+            unlock();
+        }
+        /**
+         * Creates enough instances that at least `count` are free.
+         */
+        void reserve(size_t count) {
+            for (size_t index = free_count(); index < count; ++index) {
+                recycle(new T);
+            }
+        }
+        size_t free_count() {
+            size_t count = 0;
+            lock();
+            for (T *instance_ = free_list; instance_ != nullptr; instance_ = instance_->next_free) {
+                ++count;
+            }
+            unlock();
+            return count;
+        }
+    private:
+        void lock() {
+            while (spinlock.test_and_set(std::memory_order_acquire)) {
+            }
+        }
+        void unlock() {
+            spinlock.clear(std::memory_order_release);
+        }
+        std::atomic_flag spinlock = ATOMIC_FLAG_INIT;
+        T *free_list = nullptr;
+};
+
+/**
+ * Base class for invokables that are recycled through a 
+ * `CxxInvokablePool<T>` rather than deleted; `T` is the derived class.
+ */
+template <typename T, typename Base = CxxInvokableBase>
+class CxxPooledInvokable : public Base {
+    public:
+        void release() override {
+            CxxInvokablePool<T>::instance().recycle(static_cast<T *>(this));
+        }
+        T *next_free = nullptr;
+};
+
+/**
+ * Describes how to construct an invokable in memory that is owned by 
+ * Csound. If a module exports, next to a factory named `name`, a function 
+ * named `name_placement` that returns one of these, `cxx_invoke` allocates 
+ * the memory for each instance with `AuxAlloc` instead of calling the 
+ * factory. That memory belongs to the Csound instrument instance, so when 
+ * Csound reuses the instrument instance for a new note, no memory is 
+ * allocated at all. The instance's destructor is called at noteoff, but the 
+ * memory is not freed.
+ */
+struct CxxPlacementFactory {
+    size_t size;
+    size_t alignment;
+    CxxInvokable *(*construct)(void *memory);
+};
+
+extern "C" {
+    typedef const CxxPlacementFactory *(*cxx_invokable_placement_t)();
+};
+
+/**
+ * Defines both a factory named `factory_name` for `T`, and the 
+ * corresponding `factory_name_placement` function.
+ */
+#define CXX_PLACEMENT_FACTORY(factory_name, T) \
+    extern "C" CxxInvokable *factory_name() { \
+        return new T; \
+    } \
+    extern "C" const CxxPlacementFactory *factory_name##_placement() { \
+        static const CxxPlacementFactory placement = {sizeof(T), alignof(T), [] (void *memory) -> CxxInvokable * { return new (memory) T; }}; \
+        return &placement; \
+    }
+
+/**
+ * Plain function pointers for the methods of an invokable class. If a 
+ * module exports, next to a factory named `name`, a function named 
+ * `name_dispatch` that returns one of these, `cxx_invoke` looks it up once 
+ * per call site and calls through it, instead of making virtual calls 
+ * through the instance. The functions call the methods of `T` with 
+ * qualified names, so no vtable is involved and the compiler can inline 
+ * the methods into the functions.
+ */
+struct CxxDispatch {
+    int (*init)(CxxInvokable *invokable, CSOUND *csound, OPDS *opds, MYFLT **outputs, MYFLT **inputs);
+    int (*kontrol)(CxxInvokable *invokable, CSOUND *csound, MYFLT **outputs, MYFLT **inputs);
+    int (*noteoff)(CxxInvokable *invokable, CSOUND *csound);
+};
+
+extern "C" {
+    typedef const CxxDispatch *(*cxx_invokable_dispatch_t)();
+};
+
+/**
+ * The dispatch table for `T`, which should be the most derived class of 
+ * the invokable (preferably declared `final`), because overrides in classes 
+ * derived from `T` are not called.
+ */
+template <typename T>
+struct CxxDispatchFor {
+    static int init(CxxInvokable *invokable, CSOUND *csound, OPDS *opds, MYFLT **outputs, MYFLT **inputs) {
+        return static_cast<T *>(invokable)->T::init(csound, opds, outputs, inputs);
+    }
+    static int kontrol(CxxInvokable *invokable, CSOUND *csound, MYFLT **outputs, MYFLT **inputs) {
+        return static_cast<T *>(invokable)->T::kontrol(csound, outputs, inputs);
+    }
+    static int noteoff(CxxInvokable *invokable, CSOUND *csound) {
+        return static_cast<T *>(invokable)->T::noteoff(csound);
+    }
+    static const CxxDispatch *get() {
+        static const CxxDispatch dispatch = {&init, &kontrol, &noteoff};
+        return &dispatch;
+    }
+};
+
+/**
+ * Defines a factory named `factory_name` for `T`, together with the 
+ * corresponding `factory_name_placement` and `factory_name_dispatch` 
+ * functions, so that instances of `T` are constructed in memory owned by 
+ * Csound and performed without virtual calls.
+ */
+#define CXX_REGISTER_INVOKABLE(factory_name, T) \
+    CXX_PLACEMENT_FACTORY(factory_name, T) \
+    extern "C" const CxxDispatch *factory_name##_dispatch() { \
+        return CxxDispatchFor<T>::get(); \
+    }
+
+/**
+ * An input of `cxx_invoke` whose i-time value is a compile-time parameter of 
+ * a factory's invokables: `input` is the index of the input in `inputs`, 
+ * and `macro` the name of the macro that is defined as its value.
+ */
+struct CxxSpecializationParameter {
+    const char *macro;
+    int input;
+};
+
+/**
+ * The compile-time parameters of a factory. If a module exports, next to a 
+ * factory named `name`, a function named `name_specialization` that returns 
+ * one of these, then for each distinct set of values of those inputs, 
+ * `cxx_invoke` builds a specialized version of the module, in the 
+ * background and through the module cache, with the original compiler 
+ * command plus `-DCXX_SPECIALIZED` and `-D<macro>=<value>` for each 
+ * parameter. Notes with those values then use the `name` factory of the 
+ * specialized version; until it is ready, they use the generic factory. 
+ * The entry point of a specialized version is not called. A factory may have 
+ * at most 16 parameters. The module should define `name_specialization` 
+ * only if `CXX_SPECIALIZED` is not defined:
+ * ```
+ * #if defined(DELAY_LENGTH)
+ * static constexpr size_t delay_length = DELAY_LENGTH;
+ * #else
+ * CXX_SPECIALIZATION(delay_factory, {"DELAY_LENGTH", 0})
+ * #endif
+ * ```
+ */
+struct CxxSpecialization {
+    const CxxSpecializationParameter *parameters;
+    size_t count;
+};
+
+extern "C" {
+    typedef const CxxSpecialization *(*cxx_invokable_specialization_t)();
+};
+
+/**
+ * Defines the `factory_name_specialization` function, with the parameters 
+ * given as `{"MACRO", input}` pairs.
+ */
+#define CXX_SPECIALIZATION(factory_name, ...) \
+    extern "C" const CxxSpecialization *factory_name##_specialization() { \
+        static const CxxSpecializationParameter parameters[] = {__VA_ARGS__}; \
+        static const CxxSpecialization specialization = {parameters, sizeof(parameters) / sizeof(parameters[0])}; \
+        return &specialization; \
+    }
+
+/**
+ * A voice group lets all live instances ("voices") of one factory share 
+ * one call per kperiod, with the state of the voices kept in a structure 
+ * of arrays, so that loops can be vectorized across voices as well as 
+ * across samples.
+ *
+ * `Derived` is the group class itself. There is one group per Csound 
+ * instance, constructed on first use as `Derived(csound)`, and destroyed 
+ * when the module is unloaded, or on first use after the Csound instance 
+ * has been reset. No Csound callback is registered for it, because Csound 
+ * could call it after the module has been unloaded. The constructor 
+ * declares the group's arrays with `add_array(array, width)`, where `width` 
+ * is the number of values per voice (1 for a scalar, `ksmps` for a block of 
+ * audio); the group resizes, clears, and compacts all of these arrays as 
+ * voices come and go, and voice `v` owns the values from `v * width` up to 
+ * `(v + 1) * width`. `Derived` must also define:
+ * ```
+ * void gather(size_t voice, CSOUND *csound, MYFLT **inputs);
+ * void scatter(size_t voice, CSOUND *csound, MYFLT **outputs);
+ * int process_voices(CSOUND *csound, size_t voice_count);
+ * ```
+ * Every kperiod, the first voice to be performed calls `process_voices` 
+ * once for all voices. Then each voice, when it is performed, `gather`s its 
+ * inputs into the arrays and `scatter`s its outputs from them. Voices 
+ * therefore hear inputs one kperiod late, but may be performed on any 
+ * Csound thread in any order. All of these functions are called while 
+ * holding the group's spinlock.
+ */
+template <typename Derived>
+class CxxVoiceGroup {
+    public:
+        static Derived &for_csound(CSOUND *csound) {
+            std::lock_guard<std::mutex> lock(groups_mutex());
+            auto &group = groups()[csound];
+            // Csound destroys its global variables when it is reset, so if 
+            // the marker is missing, any group is from an earlier 
+            // performance, or from an earlier Csound instance at the same 
+            // address.
+            char marker_name[64];
+            std::snprintf(marker_name, sizeof(marker_name), "cxx_voice_group_%p", (void *) &groups());
+            if (csound->QueryGlobalVariable(csound, marker_name) == nullptr) {
+                group.reset();
+                csound->CreateGlobalVariable(csound, marker_name, 1);
+            }
+            if (!group) {
+                group.reset(new Derived(csound));
+            }
+            return *group;
+        }
+        size_t voice_count() const {
+            return voices.size();
+        }
+        /**
+         * Preallocates the arrays for a number of voices, so that adding 
+         * voices does not allocate.
+         */
+        void reserve_voices(size_t capacity) {
+            lock();
+            resize_arrays(capacity);
+            unlock();
+        }
+        /**
+         * Adds a voice, whose values are cleared. The group keeps `slot` up 
+         * to date with the voice's index, which changes when the arrays are 
+         * compacted.
+         */
+        void add_voice(size_t *slot) {
+            lock();
+            size_t voice = voices.size();
+            if (voice >= capacity) {
+                resize_arrays(capacity == 0 ? 16 : capacity * 2);
+            }
+            for (auto &array : arrays) {
+                std::fill(array.values->begin() + voice * array.width, array.values->begin() + (voice + 1) * array.width, MYFLT(0));
+            }
+            voices.push_back(slot);
+            *slot = voice;
+            unlock();
+        }
+        /**
+         * Removes a voice, moving the last voice into its place.
+         */
+        void remove_voice(size_t *slot) {
+            lock();
+            size_t voice = *slot;
+            size_t last = voices.size() - 1;
+            if (voice != last) {
+                for (auto &array : arrays) {
+                    std::copy(array.values->begin() + last * array.width, array.values->begin() + (last + 1) * array.width, array.values->begin() + voice * array.width);
+                }
+                voices[voice] = voices[last];
+                *voices[voice] = voice;
+            }
+            voices.pop_back();
+            unlock();
+        }
+        /**
+         * Performs a voice; takes the slot rather than the index, because 
+         * the index may change until the lock is held.
+         */
+        int kontrol_voice(const size_t *slot, CSOUND *csound, MYFLT **outputs, MYFLT **inputs) {
+            int result = OK;
+            lock();
+            size_t voice = *slot;
+            auto kcounter = csound->GetKcounter(csound);
+            if (kcounter != last_kcounter) {
+                last_kcounter = kcounter;
+                result = derived().process_voices(csound, voices.size());
+            }
+            derived().gather(voice, csound, inputs);
+            derived().scatter(voice, csound, outputs);
+            unlock();
+            return result;
+        }
+    protected:
+        void add_array(std::vector<MYFLT> &values, size_t width = 1) {
+            values.resize(capacity * width);
+            arrays.push_back({&values, width});
+        }
+    private:
+        struct Array {
+            std::vector<MYFLT> *values;
+            size_t width;
+        };
+        Derived &derived() {
+            return *static_cast<Derived *>(this);
+        }
+        void resize_arrays(size_t capacity_) {
+            if (capacity_ > capacity) {
+                capacity = capacity_;
+                for (auto &array : arrays) {
+                    array.values->resize(capacity * array.width);
+                }
+            }
+        }
+        void lock() {
+            while (spinlock.test_and_set(std::memory_order_acquire)) {
+            }
+        }
+        void unlock() {
+            spinlock.clear(std::memory_order_release);
+        }
+        static std::mutex &groups_mutex() {
+            static std::mutex mutex_;
+            return mutex_;
+        }
+        static std::unordered_map<CSOUND *, std::unique_ptr<Derived>> &groups() {
+            static std::unordered_map<CSOUND *, std::unique_ptr<Derived>> groups_;
+            return groups_;
+        }
+        std::vector<Array> arrays;
+        std::vector<size_t *> voices;
+        size_t capacity = 0;
+        long last_kcounter = -1;
+        std::atomic_flag spinlock = ATOMIC_FLAG_INIT;
+};
+
+/**
+ * Base class for the voices of a `CxxVoiceGroup`, which must be invoked 
+ * with *i_thread* 3. Its `kontrol` only takes part in the group's kperiod.
+ */
+template <typename Group>
+class CxxGroupedInvokable : public CxxInvokableBase {
+    public:
+        int init(CSOUND *csound_, OPDS *opds_, MYFLT **outputs, MYFLT **inputs) override {
+            int result = CxxInvokableBase::init(csound_, opds_, outputs, inputs);
+            group = &Group::for_csound(csound_);
+            group->add_voice(&slot);
+            return result;
+        }
+        int kontrol(CSOUND *csound_, MYFLT **outputs, MYFLT **inputs) override {
+            if (group == nullptr) {
+                return OK;
+            }
+            return group->kontrol_voice(&slot, csound_, outputs, inputs);
+        }
+        int noteoff(CSOUND *csound_) override {
+            if (group != nullptr) {
+                group->remove_voice(&slot);
+                group = nullptr;
+            }
+            return OK;
+        }
+        /**
+         * The index of this voice in the group's arrays.
+         */
+        size_t voice() const {
+            return slot;
+        }
+    protected:
+        Group *group = nullptr;
+        size_t slot = 0;
+};
+
+/**
+ * Named channels through which invokables, also in different modules, 
+ * share blocks of data without copying it into Csound variables or taking 
+ * locks. A channel is created by the first `CxxRingChannel` or 
+ * `CxxSharedBlock` that opens its name, and lives until the last one is 
+ * closed; its memory belongs to the opcodes, not to any module. Opening and 
+ * closing take a lock and may allocate, and are meant for `init` and 
+ * `noteoff` (or a module's own threads); pushing, popping, writing, and 
+ * reading are lock-free, and may be done from any thread, including 
+ * threads that are not Csound's.
+ */
+enum CxxChannelKind {
+    // A ring with one producer and one consumer.
+    CXX_CHANNEL_SPSC = 1,
+    // A ring with any number of producers and one consumer.
+    CXX_CHANNEL_MPSC = 2,
+    // A block with one writer and any number of readers.
+    CXX_CHANNEL_BLOCK = 3,
+};
+
+/**
+ * Everyone that opens a channel must agree on its shape, or the channel is 
+ * not opened. A `capacity` of 0 opens an existing channel with whatever 
+ * capacity it has.
+ */
+struct CxxChannelShape {
+    int kind;
+    size_t element_size;
+    size_t element_alignment;
+    // The number of elements in a ring, or in a block.
+    size_t capacity;
+};
+
+/**
+ * The shared state of a channel, which the opcodes allocate and initialize. 
+ * The positions are on separate cache lines, so that producers and 
+ * consumers do not invalidate one another's caches.
+ */
+struct CxxChannelState {
+    CxxChannelShape shape;
+    // The distance between elements, a multiple of their alignment.
+    size_t stride;
+    // For rings, `capacity` elements, each with a sequence for the MPSC 
+    // protocol; for blocks, two blocks of `capacity` elements each.
+    unsigned char *elements;
+    std::atomic<size_t> *sequences;
+    // For rings, the next positions to write and read; for blocks, the 
+    // number of blocks published, and the number of the block being 
+    // written.
+    alignas(64) std::atomic<size_t> write_position;
+    alignas(64) std::atomic<size_t> read_position;
+};
+
+/**
+ * The functions through which modules open and close channels, which the 
+ * opcodes store in the Csound global variable `cxx_channel_registry`.
+ */
+struct CxxChannelRegistry {
+    // Returns nullptr if the channel exists with another shape, or if it 
+    // does not exist and `shape->capacity` is 0.
+    CxxChannelState *(*open)(CSOUND *csound, const char *name, const CxxChannelShape *shape);
+    void (*close)(CSOUND *csound, CxxChannelState *channel);
+};
+
+static inline const CxxChannelRegistry *cxx_channel_registry(CSOUND *csound) {
+    return static_cast<const CxxChannelRegistry *>(csound->QueryGlobalVariable(csound, "cxx_channel_registry"));
+}
+
+/**
+ * Base class of the typed views of a channel, which close it when they are 
+ * destroyed. `T` must be trivially copyable, because elements are shared 
+ * between modules, as raw memory, without being constructed.
+ */
+template <typename T>
+class CxxChannel {
+    public:
+        static_assert(std::is_trivially_copyable<T>::value, "The elements of a channel must be trivially copyable.");
+        CxxChannel() {}
+        CxxChannel(const CxxChannel &) = delete;
+        CxxChannel &operator=(const CxxChannel &) = delete;
+        ~CxxChannel() {
+            close();
+        }
+        /**
+         * Returns whether the channel is open; it is not if the opcodes are 
+         * too old or the shape does not match.
+         */
+        bool is_open() const {
+            return state != nullptr;
+        }
+        size_t capacity() const {
+            return state->shape.capacity;
+        }
+        void close() {
+            if (state != nullptr) {
+                registry->close(csound, state);
+                state = nullptr;
+            }
+        }
+    protected:
+        bool open(CSOUND *csound_, const char *name, int kind, size_t capacity) {
+            close();
+            csound = csound_;
+            registry = cxx_channel_registry(csound);
+            if (registry == nullptr) {
+                return false;
+            }
+            CxxChannelShape shape{kind, sizeof(T), alignof(T), capacity};
+            state = registry->open(csound, name, &shape);
+            return state != nullptr;
+        }
+        T *element(size_t index) const {
+            return reinterpret_cast<T *>(state->elements + index * state->stride);
+        }
+        CSOUND *csound = nullptr;
+        const CxxChannelRegistry *registry = nullptr;
+        CxxChannelState *state = nullptr;
+};
+
+/**
+ * A bounded, lock-free ring of `T`, with one consumer and either one 
+ * producer or, if opened with `multiple_producers`, any number of them. A 
+ * single producer can fill elements in place with `back` and `push`, and 
+ * the consumer can use elements in place with `front` and `pop`, so that 
+ * nothing is copied.
+ */
+template <typename T>
+class CxxRingChannel : public CxxChannel<T> {
+    public:
+        CxxRingChannel() {}
+        CxxRingChannel(CSOUND *csound, const char *name, size_t capacity, bool multiple_producers = false) {
+            open(csound, name, capacity, multiple_producers);
+        }
+        bool open(CSOUND *csound, const char *name, size_t capacity, bool multiple_producers = false) {
+            return CxxChannel<T>::open(csound, name, multiple_producers ? CXX_CHANNEL_MPSC : CXX_CHANNEL_SPSC, capacity);
+        }
+        /**
+         * Copies a value into the ring; returns false if the ring is full.
+         */
+        bool try_push(const T &value) {
+            if (this->state->shape.kind == CXX_CHANNEL_SPSC) {
+                auto slot = back();
+                if (slot == nullptr) {
+                    return false;
+                }
+                *slot = value;
+                push();
+                return true;
+            }
+            auto &write_position = this->state->write_position;
+            auto capacity_ = this->state->shape.capacity;
+            auto position = write_position.load(std::memory_order_relaxed);
+            for (;;) {
+                auto &sequence = this->state->sequences[position % capacity_];
+                auto difference = intptr_t(sequence.load(std::memory_order_acquire)) - intptr_t(position);
+                if (difference == 0) {
+                    if (write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        *this->element(position % capacity_) = value;
+                        sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = write_position.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        /**
+         * For a single producer: returns the element to fill, or nullptr if 
+         * the ring is full.
+         */
+        T *back() {
+            auto position = this->state->write_position.load(std::memory_order_relaxed);
+            if (position - this->state->read_position.load(std::memory_order_acquire) == this->state->shape.capacity) {
+                return nullptr;
+            }
+            return this->element(position % this->state->shape.capacity);
+        }
+        /**
+         * For a single producer: publishes the element returned by `back`.
+         */
+        void push() {
+            auto position = this->state->write_position.load(std::memory_order_relaxed);
+            this->state->write_position.store(position + 1, std::memory_order_release);
+        }
+        /**
+         * Returns the oldest element, or nullptr if the ring is empty.
+         */
+        const T *front() const {
+            auto position = this->state->read_position.load(std::memory_order_relaxed);
+            if (this->state->shape.kind == CXX_CHANNEL_SPSC) {
+                if (position == this->state->write_position.load(std::memory_order_acquire)) {
+                    return nullptr;
+                }
+            } else if (this->state->sequences[position % this->state->shape.capacity].load(std::memory_order_acquire) != position + 1) {
+                return nullptr;
+            }
+            return this->element(position % this->state->shape.capacity);
+        }
+        /**
+         * Releases the element returned by `front`.
+         */
+        void pop() {
+            auto position = this->state->read_position.load(std::memory_order_relaxed);
+            if (this->state->shape.kind == CXX_CHANNEL_MPSC) {
+                this->state->sequences[position % this->state->shape.capacity].store(position + this->state->shape.capacity, std::memory_order_release);
+            }
+            this->state->read_position.store(position + 1, std::memory_order_release);
+        }
+        /**
+         * Copies the oldest value out of the ring; returns false if the ring 
+         * is empty.
+         */
+        bool try_pop(T &value) {
+            auto element_ = front();
+            if (element_ == nullptr) {
+                return false;
+            }
+            value = *element_;
+            pop();
+            return true;
+        }
+};
+
+/**
+ * A double-buffered block of `capacity` elements of `T`, such as a 
+ * spectrum or a set of control values, that one writer publishes and any 
+ * number of readers read in place. The writer fills the block returned by 
+ * `begin_write` and calls `publish`; readers get the latest published block 
+ * from `begin_read`. Because there are only two buffers, a reader that 
+ * takes longer than one publishing period may see the block change under 
+ * it; a reader that needs a consistent block checks `end_read`, and if it 
+ * returns false, reads again or keeps its previous result.
+ */
+template <typename T>
+class CxxSharedBlock : public CxxChannel<T> {
+    public:
+        CxxSharedBlock() {}
+        CxxSharedBlock(CSOUND *csound, const char *name, size_t capacity) {
+            open(csound, name, capacity);
+        }
+        bool open(CSOUND *csound, const char *name, size_t capacity) {
+            return CxxChannel<T>::open(csound, name, CXX_CHANNEL_BLOCK, capacity);
+        }
+        /**
+         * Returns the buffer that is not being read, which still holds the 
+         * block before the latest one.
+         */
+        T *begin_write() {
+            auto published = this->state->write_position.load(std::memory_order_relaxed);
+            this->state->read_position.store(published + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return this->element(((published + 1) % 2) * this->state->shape.capacity);
+        }
+        void publish() {
+            auto published = this->state->write_position.load(std::memory_order_relaxed);
+            this->state->write_position.store(published + 1, std::memory_order_release);
+        }
+        /**
+         * Returns the latest published block, or nullptr if none has been 
+         * published yet, and sets `sequence` for `end_read`.
+         */
+        const T *begin_read(size_t &sequence) const {
+            sequence = this->state->write_position.load(std::memory_order_acquire);
+            if (sequence == 0) {
+                return nullptr;
+            }
+            return this->element((sequence % 2) * this->state->shape.capacity);
+        }
+        /**
+         * Returns whether the block returned by `begin_read` was not 
+         * overwritten while it was being read.
+         */
+        bool end_read(size_t sequence) const {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return this->state->read_position.load(std::memory_order_relaxed) < sequence + 2;
+        }
+        /**
+         * The number of blocks published so far.
+         */
+        size_t sequence() const {
+            return this->state->write_position.load(std::memory_order_acquire);
+        }
+};
+
+/**
+ * The functions through which modules map files into memory, which the 
+ * opcodes store in the Csound global variable `cxx_mapped_file_registry`. 
+ * Each file is mapped once per process, read-only, however many instances 
+ * or modules map it, and is unmapped when the last of them unmaps it.
+ */
+struct CxxMappedFileRegistry {
+    // Returns nullptr, and sets `*size` to 0, if the file cannot be mapped.
+    const unsigned char *(*map)(CSOUND *csound, const char *filepath, size_t *size);
+    void (*unmap)(CSOUND *csound, const unsigned char *data);
+};
+
+static inline const CxxMappedFileRegistry *cxx_mapped_file_registry(CSOUND *csound) {
+    return static_cast<const CxxMappedFileRegistry *>(csound->QueryGlobalVariable(csound, "cxx_mapped_file_registry"));
+}
+
+/**
+ * The format and the samples of a RIFF WAVE file, found by 
+ * `cxx_parse_wave`. `format` is 1 for integer PCM and 3 for floating point 
+ * samples.
+ */
+struct CxxWaveData {
+    int format = 0;
+    int channels = 0;
+    int sample_rate = 0;
+    int bits_per_sample = 0;
+    const unsigned char *samples = nullptr;
+    size_t frames = 0;
+};
+
+/**
+ * Finds the format and the sample data of a RIFF WAVE file in memory; 
+ * returns false if it is not one.
+ */
+static inline bool cxx_parse_wave(const unsigned char *data, size_t size, CxxWaveData &wave) {
+    auto read_16 = [](const unsigned char *p) -> uint32_t {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8);
+    };
+    auto read_32 = [](const unsigned char *p) -> uint32_t {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    };
+    wave = CxxWaveData();
+    if (data == nullptr || size < 12 || std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    size_t block_align = 0;
+    size_t position = 12;
+    while (position + 8 <= size) {
+        auto chunk = data + position;
+        size_t chunk_size = read_32(chunk + 4);
+        auto body = chunk + 8;
+        size_t available = std::min(chunk_size, size - position - 8);
+        if (std::memcmp(chunk, "fmt ", 4) == 0 && available >= 16) {
+            wave.format = read_16(body);
+            wave.channels = read_16(body + 2);
+            wave.sample_rate = read_32(body + 4);
+            block_align = read_16(body + 12);
+            wave.bits_per_sample = read_16(body + 14);
+            // WAVE_FORMAT_EXTENSIBLE gives the format in its subformat.
+            if (wave.format == 0xFFFE && available >= 26) {
+                wave.format = read_16(body + 24);
+            }
+        } else if (std::memcmp(chunk, "data", 4) == 0 && block_align > 0) {
+            wave.samples = body;
+            wave.frames = available / block_align;
+            return wave.channels > 0;
+        }
+        position += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+/**
+ * A file, such as a sample library or an impulse response, mapped 
+ * read-only into memory, which is shared by every `CxxMappedFile` for the 
+ * same file in the process. Mapping takes a lock and is meant for `init`; 
+ * pages are read from the file when they are first touched.
+ */
+class CxxMappedFile {
+    public:
+        CxxMappedFile() {}
+        CxxMappedFile(CSOUND *csound_, const char *filepath) {
+            open(csound_, filepath);
+        }
+        CxxMappedFile(const CxxMappedFile &) = delete;
+        CxxMappedFile &operator=(const CxxMappedFile &) = delete;
+        ~CxxMappedFile() {
+            close();
+        }
+        bool open(CSOUND *csound_, const char *filepath) {
+            close();
+            csound = csound_;
+            registry = cxx_mapped_file_registry(csound);
+            if (registry == nullptr) {
+                return false;
+            }
+            data = registry->map(csound, filepath, &size);
+            return data != nullptr;
+        }
+        void close() {
+            if (data != nullptr) {
+                registry->unmap(csound, data);
+                data = nullptr;
+                size = 0;
+            }
+        }
+        bool is_open() const {
+            return data != nullptr;
+        }
+        const unsigned char *get() const {
+            return data;
+        }
+        size_t get_size() const {
+            return size;
+        }
+        /**
+         * Returns a view of the file from `offset` bytes as elements of 
+         * type `T`, e.g. a raw file of `float` samples.
+         */
+        template <typename T>
+        CxxTableSpan<const T> as(size_t offset = 0, size_t channels = 1) const {
+            offset = std::min(offset, size);
+            return {reinterpret_cast<const T *>(data + offset), (size - offset) / sizeof(T), channels};
+        }
+        /**
+         * If the file is a WAVE file with samples of type `T` (`float` or 
+         * `double` for floating point files, `int16_t` or `int32_t` for 
+         * integer files), returns a view of its interleaved samples, and 
+         * otherwise an empty view. `wave` receives the format in any case, 
+         * so that other formats can be converted from `wave.samples`.
+         */
+        template <typename T>
+        CxxTableSpan<const T> wave_samples(CxxWaveData &wave) const {
+            CxxTableSpan<const T> span;
+            if (cxx_parse_wave(data, size, wave) == false) {
+                return span;
+            }
+            bool floating = std::is_floating_point<T>::value;
+            if ((wave.format == 3) != floating || size_t(wave.bits_per_sample) != 8 * sizeof(T) || (uintptr_t(wave.samples) % alignof(T)) != 0) {
+                return span;
+            }
+            span.data = reinterpret_cast<const T *>(wave.samples);
+            span.size = wave.frames * wave.channels;
+            span.channels = wave.channels;
+            return span;
+        }
+    private:
+        CSOUND *csound = nullptr;
+        const CxxMappedFileRegistry *registry = nullptr;
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+};
+
+/**
+ * Real-time safety checks. If the compiler command of a module contains 
+ * `-+cxx_rtcheck`, the module is compiled with `CXX_RT_CHECK` defined, and 
+ * `cxx_invoke` counts, for each call of `kontrol` and `noteoff`, the 
+ * calls that the module makes on the calling thread to functions that may 
+ * block or take an unbounded time. These calls are intercepted, on Linux, 
+ * by linking the module with `--wrap` for each function in 
+ * `cxx_rt_checked_functions` (`CXX_RT_CHECK_WRAP` is then defined); 
+ * elsewhere only the time of each call is checked. Only the module's own 
+ * calls are seen, not calls made inside other libraries, such as the 
+ * allocations of `std::string` inside the C++ standard library.
+ */
+struct CxxRtViolations {
+    // malloc, free, new, and delete.
+    uint64_t allocations;
+    // Mutexes, read-write locks, condition variables, semaphores, and joins.
+    uint64_t locks;
+    // Standard I/O, file I/O, and sleeps.
+    uint64_t system_calls;
+};
+
+extern "C" {
+    typedef void (*cxx_rt_check_scope_t)(int active, CxxRtViolations *violations);
+};
+
+/**
+ * For each intercepted function, what it violates, its result type, its 
+ * (mangled) name, its parameters, and its arguments. `printf` and 
+ * `fprintf`, which take variable arguments, are intercepted separately.
+ */
+#define CXX_RT_CHECKED_FUNCTIONS(X) \
+    X(allocations, void *, malloc, (size_t size), (size)) \
+    X(allocations, void *, calloc, (size_t count, size_t size), (count, size)) \
+    X(allocations, void *, realloc, (void *pointer, size_t size), (pointer, size)) \
+    X(allocations, void, free, (void *pointer), (pointer)) \
+    X(allocations, int, posix_memalign, (void **pointer, size_t alignment, size_t size), (pointer, alignment, size)) \
+    X(allocations, void *, aligned_alloc, (size_t alignment, size_t size), (alignment, size)) \
+    X(allocations, void *, _Znwm, (size_t size), (size)) \
+    X(allocations, void *, _Znam, (size_t size), (size)) \
+    X(allocations, void *, _ZnwmSt11align_val_t, (size_t size, size_t alignment), (size, alignment)) \
+    X(allocations, void *, _ZnamSt11align_val_t, (size_t size, size_t alignment), (size, alignment)) \
+    X(allocations, void, _ZdlPv, (void *pointer), (pointer)) \
+    X(allocations, void, _ZdaPv, (void *pointer), (pointer)) \
+    X(allocations, void, _ZdlPvm, (void *pointer, size_t size), (pointer, size)) \
+    X(allocations, void, _ZdaPvm, (void *pointer, size_t size), (pointer, size)) \
+    X(allocations, void, _ZdlPvSt11align_val_t, (void *pointer, size_t alignment), (pointer, alignment)) \
+    X(allocations, void, _ZdaPvSt11align_val_t, (void *pointer, size_t alignment), (pointer, alignment)) \
+    X(allocations, void, _ZdlPvmSt11align_val_t, (void *pointer, size_t size, size_t alignment), (pointer, size, alignment)) \
+    X(allocations, void, _ZdaPvmSt11align_val_t, (void *pointer, size_t size, size_t alignment), (pointer, size, alignment)) \
+    X(locks, int, pthread_mutex_lock, (void *mutex), (mutex)) \
+    X(locks, int, pthread_rwlock_rdlock, (void *lock), (lock)) \
+    X(locks, int, pthread_rwlock_wrlock, (void *lock), (lock)) \
+    X(locks, int, pthread_cond_wait, (void *condition, void *mutex), (condition, mutex)) \
+    X(locks, int, pthread_cond_timedwait, (void *condition, void *mutex, const void *time), (condition, mutex, time)) \
+    X(locks, int, pthread_join, (unsigned long thread, void **result), (thread, result)) \
+    X(locks, int, sem_wait, (void *semaphore), (semaphore)) \
+    X(system_calls, int, vprintf, (const char *format, va_list arguments), (format, arguments)) \
+    X(system_calls, int, vfprintf, (FILE *file, const char *format, va_list arguments), (file, format, arguments)) \
+    X(system_calls, int, puts, (const char *text), (text)) \
+    X(system_calls, int, putchar, (int c), (c)) \
+    X(system_calls, int, fputs, (const char *text, FILE *file), (text, file)) \
+    X(system_calls, size_t, fwrite, (const void *data, size_t size, size_t count, FILE *file), (data, size, count, file)) \
+    X(system_calls, int, fflush, (FILE *file), (file)) \
+    X(system_calls, FILE *, fopen, (const char *filepath, const char *mode), (filepath, mode)) \
+    X(system_calls, int, fclose, (FILE *file), (file)) \
+    X(system_calls, long, write, (int descriptor, const void *data, size_t size), (descriptor, data, size)) \
+    X(system_calls, long, read, (int descriptor, void *data, size_t size), (descriptor, data, size)) \
+    X(system_calls, int, usleep, (unsigned microseconds), (microseconds)) \
+    X(system_calls, int, nanosleep, (const void *time, void *remaining), (time, remaining)) \
+    X(system_calls, unsigned, sleep, (unsigned seconds), (seconds))
+
+#define CXX_RT_CHECKED_NAME(kind, result, name, parameters, arguments) #name,
+
+/**
+ * The names of the intercepted functions, terminated by nullptr.
+ */
+static const char *const cxx_rt_checked_functions[] = {
+    CXX_RT_CHECKED_FUNCTIONS(CXX_RT_CHECKED_NAME)
+    "printf",
+    "fprintf",
+    nullptr
+};
+
+#if defined(CXX_RT_CHECK)
+
+/**
+ * Counts the violations of the current thread while `active`. It is 
+ * constant-initialized, so that using it never allocates.
+ */
+struct CxxRtScope {
+    bool active;
+    CxxRtViolations violations;
+};
+
+static thread_local CxxRtScope cxx_rt_scope;
+
+/**
+ * Called by `cxx_invoke` around each call of `kontrol` and `noteoff`: with 
+ * `active` 1 to start counting, and with `active` 0 to stop counting and 
+ * return the counts in `violations`.
+ */
+extern "C" void cxx_rt_check_scope(int active, CxxRtViolations *violations) {
+    if (active) {
+        cxx_rt_scope.violations = CxxRtViolations{0, 0, 0};
+        cxx_rt_scope.active = true;
+    } else {
+        cxx_rt_scope.active = false;
+        if (violations != nullptr) {
+            *violations = cxx_rt_scope.violations;
+        }
+    }
+}
+
+static inline void cxx_rt_violation(uint64_t CxxRtViolations::*kind) {
+    if (cxx_rt_scope.active) {
+        ++(cxx_rt_scope.violations.*kind);
+    }
+}
+
+#if defined(CXX_RT_CHECK_WRAP)
+#define CXX_RT_CHECKED_WRAPPER(kind, result, name, parameters, arguments) \
+    extern "C" result __real_##name parameters; \
+    extern "C" result __wrap_##name parameters { \
+        cxx_rt_violation(&CxxRtViolations::kind); \
+        return __real_##name arguments; \
+    }
+
+CXX_RT_CHECKED_FUNCTIONS(CXX_RT_CHECKED_WRAPPER)
+
+extern "C" int __wrap_printf(const char *format, ...) {
+    cxx_rt_violation(&CxxRtViolations::system_calls);
+    va_list arguments;
+    va_start(arguments, format);
+    int result = __real_vprintf(format, arguments);
+    va_end(arguments);
+    return result;
+}
+
+extern "C" int __wrap_fprintf(FILE *file, const char *format, ...) {
+    cxx_rt_violation(&CxxRtViolations::system_calls);
+    va_list arguments;
+    va_start(arguments, format);
+    int result = __real_vfprintf(file, format, arguments);
+    va_end(arguments);
+    return result;
+}
+#endif
+#endif
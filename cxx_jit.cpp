@@ -0,0 +1,245 @@
+/**
+ * cxx_jit.cpp - this file is part of cxx-opcodes.
+ *
+ * Copyright (C) 2021 by Michael Gogins
+ *
+ * cxx-opcodes is free software; you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cxxopcodes is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cxx-opcodes; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * This file implements the in-process compiler backend declared in
+ * cxx_jit.hpp, using Clang to compile C++ to LLVM IR in memory, and LLVM's
+ * ORC LLJIT to link the IR into the Csound process. It is written for the
+ * Clang and LLVM C++ APIs of versions 14 through 19.
+ */
+
+#include "cxx_jit.hpp"
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/CodeGen/CodeGenAction.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/TextDiagnosticPrinter.h>
+#include <clang/Frontend/Utils.h>
+#include <clang/Lex/PreprocessorOptions.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Each module gets its own LLJIT instance, so that modules can be compiled
+ * concurrently, and so that symbols in one module do not collide with
+ * symbols in another, just as with dynamic link libraries opened by these
+ * opcodes.
+ */
+struct JitModule {
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+};
+
+static std::mutex &jit_modules_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+/**
+ * JIT compiled modules, like the dynamic link libraries loaded by these
+ * opcodes, are kept until they are released.
+ */
+static std::map<void *, std::unique_ptr<JitModule>> &jit_modules() {
+    static std::map<void *, std::unique_ptr<JitModule>> jit_modules_;
+    return jit_modules_;
+}
+
+static void initialize_native_target() {
+    static std::once_flag once;
+    std::call_once(once, [] () {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+    });
+}
+
+/**
+ * Returns the compiler options from an external compiler command, without
+ * the compiler name and without options that only concern linking or the
+ * output file.
+ */
+static std::vector<std::string> compiler_options(const std::string &compiler_command, bool &has_resource_dir) {
+    std::vector<std::string> options;
+    std::istringstream stream(compiler_command);
+    std::string token;
+    bool first = true;
+    has_resource_dir = false;
+    while (stream >> token) {
+        if (first) {
+            first = false;
+            continue;
+        }
+        if (token == "-shared" || token == "-rdynamic" || token == "-c" ||
+            token.rfind("-o", 0) == 0 || token.rfind("-l", 0) == 0 ||
+            token.rfind("-L", 0) == 0 || token.rfind("-Wl,", 0) == 0) {
+            continue;
+        }
+        if (token.rfind("-resource-dir", 0) == 0) {
+            has_resource_dir = true;
+        }
+        options.push_back(token);
+    }
+    return options;
+}
+
+void *cxx_jit_compile(const std::string &source_code, const std::string &compiler_command, std::string &diagnostics) {
+    initialize_native_target();
+    static const char *source_filename = "cxx_jit_module.cpp";
+    bool has_resource_dir;
+    auto options = compiler_options(compiler_command, has_resource_dir);
+    std::vector<const char *> arguments;
+    arguments.push_back("clang++");
+    for (const auto &option : options) {
+        arguments.push_back(option.c_str());
+    }
+#if defined(CXX_JIT_RESOURCE_DIR)
+    // Clang needs its own headers, e.g. for intrinsics.
+    if (has_resource_dir == false) {
+        arguments.push_back("-resource-dir");
+        arguments.push_back(CXX_JIT_RESOURCE_DIR);
+    }
+#endif
+    arguments.push_back("-c");
+    arguments.push_back(source_filename);
+    llvm::raw_string_ostream diagnostics_stream(diagnostics);
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diagnostic_options = new clang::DiagnosticOptions;
+    auto invocation_diagnostics = clang::CompilerInstance::createDiagnostics(diagnostic_options.get(), new clang::TextDiagnosticPrinter(diagnostics_stream, diagnostic_options.get()), true);
+#if LLVM_VERSION_MAJOR >= 15
+    clang::CreateInvocationOptions invocation_options;
+    invocation_options.Diags = invocation_diagnostics;
+    std::shared_ptr<clang::CompilerInvocation> invocation = clang::createInvocation(arguments, std::move(invocation_options));
+#else
+    std::shared_ptr<clang::CompilerInvocation> invocation = clang::createInvocationFromCommandLine(arguments, invocation_diagnostics);
+#endif
+    if (!invocation) {
+        diagnostics_stream << "cxx_jit: invalid compiler options.\n";
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    // The source code is compiled from memory, not from a file.
+    invocation->getPreprocessorOpts().addRemappedFile(source_filename, llvm::MemoryBuffer::getMemBufferCopy(source_code, source_filename).release());
+    invocation->getFrontendOpts().DisableFree = false;
+    clang::CompilerInstance compiler;
+    compiler.setInvocation(invocation);
+    compiler.createDiagnostics(new clang::TextDiagnosticPrinter(diagnostics_stream, &compiler.getDiagnosticOpts()), true);
+    auto context = std::make_unique<llvm::LLVMContext>();
+    clang::EmitLLVMOnlyAction action(context.get());
+    if (compiler.ExecuteAction(action) == false) {
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    auto module = action.takeModule();
+    if (!module) {
+        diagnostics_stream << "cxx_jit: no module was generated.\n";
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    auto jit = llvm::orc::LLJITBuilder().create();
+    if (!jit) {
+        diagnostics_stream << "cxx_jit: " << llvm::toString(jit.takeError()) << "\n";
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    auto &main_dylib = (*jit)->getMainJITDylib();
+    // Undefined symbols resolve to symbols already loaded in the process:
+    // the C and C++ runtime libraries, and the dependencies preloaded in
+    // global scope.
+    auto generator = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*jit)->getDataLayout().getGlobalPrefix());
+    if (!generator) {
+        diagnostics_stream << "cxx_jit: " << llvm::toString(generator.takeError()) << "\n";
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    main_dylib.addGenerator(std::move(*generator));
+    if (auto error = (*jit)->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+        diagnostics_stream << "cxx_jit: " << llvm::toString(std::move(error)) << "\n";
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    // Runs static constructors.
+    if (auto error = (*jit)->initialize(main_dylib)) {
+        diagnostics_stream << "cxx_jit: " << llvm::toString(std::move(error)) << "\n";
+        diagnostics_stream.flush();
+        return nullptr;
+    }
+    diagnostics_stream.flush();
+    auto jit_module = std::make_unique<JitModule>();
+    jit_module->jit = std::move(*jit);
+    void *module_handle = jit_module.get();
+    std::lock_guard<std::mutex> lock(jit_modules_mutex());
+    jit_modules()[module_handle] = std::move(jit_module);
+    return module_handle;
+}
+
+bool cxx_jit_is_module(void *module_handle) {
+    std::lock_guard<std::mutex> lock(jit_modules_mutex());
+    return jit_modules().find(module_handle) != jit_modules().end();
+}
+
+void *cxx_jit_symbol(void *module_handle, const char *symbol_name) {
+    llvm::orc::LLJIT *jit = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(jit_modules_mutex());
+        auto it = jit_modules().find(module_handle);
+        if (it == jit_modules().end()) {
+            return nullptr;
+        }
+        jit = it->second->jit.get();
+    }
+    auto symbol = jit->lookup(symbol_name);
+    if (!symbol) {
+        llvm::consumeError(symbol.takeError());
+        return nullptr;
+    }
+#if LLVM_VERSION_MAJOR >= 15
+    return symbol->toPtr<void *>();
+#else
+    return reinterpret_cast<void *>(symbol->getAddress());
+#endif
+}
+
+void cxx_jit_release(void *module_handle) {
+    std::unique_ptr<JitModule> jit_module;
+    {
+        std::lock_guard<std::mutex> lock(jit_modules_mutex());
+        auto it = jit_modules().find(module_handle);
+        if (it == jit_modules().end()) {
+            return;
+        }
+        jit_module = std::move(it->second);
+        jit_modules().erase(it);
+    }
+    if (auto error = jit_module->jit->deinitialize(jit_module->jit->getMainJITDylib())) {
+        llvm::consumeError(std::move(error));
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+/*
+cxx_jit.hpp - this file is part of cxx-opcodes.
+
+Copyright (C) 2021 by Michael Gogins
+
+cxx-opcodes is free software; you can redistribute it
+and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+cxx-opcodes is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with cxx-opcodes; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+02110-1301 USA
+*/
+
+/**
+ * The in-process compiler backend, which is only built if the
+ * CXX_OPCODES_USE_JIT CMake option is on (which defines CXX_OPCODES_JIT). It
+ * compiles source code with Clang into LLVM IR in memory, and links the IR
+ * into the running process with LLVM's ORC JIT, so that neither the compiler
+ * driver, nor temporary files, nor the dynamic loader are involved. Neither
+ * Clang nor LLVM headers are included here.
+ *
+ * All of these functions may be called from any thread.
+ */
+
+#include <string>
+
+/**
+ * Compiles the source code with the options in the compiler command, which
+ * has the same form as for the external compiler; the compiler name, link
+ * options, and output options are ignored. Dependencies must already have
+ * been loaded in global scope, from where the JIT resolves undefined
+ * symbols. Runs the module's static constructors. Returns an opaque handle
+ * for the module, or nullptr with the compiler's messages in `diagnostics`.
+ */
+void *cxx_jit_compile(const std::string &source_code, const std::string &compiler_command, std::string &diagnostics);
+
+/**
+ * Returns whether a module handle was returned by `cxx_jit_compile`, rather
+ * than by the dynamic loader.
+ */
+bool cxx_jit_is_module(void *module_handle);
+
+/**
+ * Returns the address of a symbol with C linkage in a JIT compiled module,
+ * or nullptr if there is no such symbol.
+ */
+void *cxx_jit_symbol(void *module_handle, const char *symbol_name);
+
+/**
+ * Runs the static destructors of a JIT compiled module and frees its code.
+ * No function in the module may be running or called again.
+ */
+void cxx_jit_release(void *module_handle);
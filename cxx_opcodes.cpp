@@ -44,28 +44,72 @@
 #include <csignal>
 #include <csound.h>
 #include <OpcodeBase.hpp>
+#include "cxx_invokable.hpp"
+#if defined(CXX_OPCODES_JIT)
+#include "cxx_jit.hpp"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION))
 #include <dlfcn.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) && defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#elif (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION))
+#include <semaphore.h>
+#endif
+#if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION))
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 #include <filesystem>
+#include <functional>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <random>
 #include <stdlib.h>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #if defined(WIN32)
 #include <windows.h>
+#define popen _popen
+#define pclose _pclose
+#include <process.h>
+#define getpid _getpid
 #endif
 
 /**
- * Diagnostics are global for all these opcodes, and also for 
- * all modules compiled by these opcodes.
+ * Deprecated: modules should call `cxx_module_diagnostics()` (see 
+ * `cxx_invokable.hpp`), which is set for each module. This one flag for the 
+ * process is only kept for modules that already read it; it is true if the 
+ * module most recently built in the process, by any Csound instance, 
+ * enabled debug messages for `cxx_invoke`. The flag is atomic because 
+ * modules may read it on all Csound threads.
  */
-PUBLIC bool &cxx_diagnostics_enabled() {
-    static bool enabled = false;
+PUBLIC std::atomic<bool> &cxx_diagnostics_enabled() {
+    static std::atomic<bool> enabled{false};
     return enabled;
 }
 
@@ -83,7 +127,6 @@ static void *cxx_load_library(const char *library_name) {
 #if (defined(__APPLE__) || defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION))
     library_handle = dlopen(library_name, RTLD_NOW | RTLD_GLOBAL);
 #endif
-    std::fprintf(stderr, "####### cxx_load_library: library_name: %s library_handle: %p\n", library_name, library_handle);
     return library_handle;
 }
 
@@ -98,12 +141,651 @@ static void tokenize(std::string const &string_, const char delimiter, std::vect
 }
 
 /**
- * This contains handles to all dynamic link libraries compiled and loaded by 
- * these opcodes in this Csound process.
+ * Closes a module's handle, whether the module was loaded by the dynamic 
+ * loader or compiled by the in-process backend. This runs the module's 
+ * static destructors, so must never be called on a Csound performance 
+ * thread.
+ */
+static void unload_module_handle(void *module_handle) {
+#if defined(CXX_OPCODES_JIT)
+    if (cxx_jit_is_module(module_handle)) {
+        cxx_jit_release(module_handle);
+        return;
+    }
+#endif
+#if defined(WIN32)
+    FreeLibrary((HMODULE) module_handle);
+#elif (defined(__APPLE__) || defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION))
+    dlclose(module_handle);
+#endif
+}
+
+/**
+ * The diagnostics of these opcodes have levels and categories. Errors are 
+ * always printed. The levels of a module's messages are set by its compiler 
+ * command: `-v` enables all messages, and `-+cxx_log=LEVEL` or 
+ * `-+cxx_log=CATEGORY:LEVEL,...` enables messages up to a level, for all 
+ * categories or for some. Messages that do not concern one module use the 
+ * levels of the Csound instance, from the `CXX_OPCODES_LOG` environment 
+ * variable in the same form. Messages above CXX_OPCODES_MAX_LOG_LEVEL are 
+ * compiled out.
+ */
+enum CxxLogLevel {
+    CXX_LOG_ERROR = 0,
+    CXX_LOG_WARNING,
+    CXX_LOG_INFO,
+    CXX_LOG_DEBUG,
+};
+
+enum CxxLogCategory {
+    // Compiling modules and precompiled headers, and the module cache.
+    CXX_LOG_COMPILE = 0,
+    // Loading, publishing, and unloading modules and their dependencies.
+    CXX_LOG_LOAD,
+    // Creating and calling instances in `cxx_invoke`.
+    CXX_LOG_INVOKE,
+    CXX_LOG_CATEGORY_COUNT
+};
+
+#if !defined(CXX_OPCODES_MAX_LOG_LEVEL)
+#define CXX_OPCODES_MAX_LOG_LEVEL CXX_LOG_DEBUG
+#endif
+
+struct CxxLogLevels {
+    int8_t levels[CXX_LOG_CATEGORY_COUNT] = {CXX_LOG_WARNING, CXX_LOG_WARNING, CXX_LOG_WARNING};
+    inline bool enabled(CxxLogCategory category, CxxLogLevel level) const {
+        return level <= CXX_OPCODES_MAX_LOG_LEVEL && level <= levels[category];
+    }
+};
+
+/**
+ * Sets log levels from a specification such as "debug" or 
+ * "compile:info,invoke:debug". Unknown names are ignored.
+ */
+static void parse_log_levels(const std::string &specification, CxxLogLevels &log_levels) {
+    static const char *level_names[] = {"error", "warning", "info", "debug"};
+    static const char *category_names[] = {"compile", "load", "invoke"};
+    std::vector<std::string> items;
+    tokenize(specification, ',', items);
+    for (const auto &item : items) {
+        auto colon = item.find(':');
+        auto level_name = colon == std::string::npos ? item : item.substr(colon + 1);
+        size_t level = std::find_if(std::begin(level_names), std::end(level_names), [&] (const char *name) { return level_name == name; }) - std::begin(level_names);
+        if (level == std::size(level_names)) {
+            continue;
+        }
+        for (int category = 0; category < CXX_LOG_CATEGORY_COUNT; ++category) {
+            if (colon == std::string::npos || item.compare(0, colon, category_names[category]) == 0) {
+                log_levels.levels[category] = int8_t(level);
+            }
+        }
+    }
+}
+
+/**
+ * While a module is being built or published on a thread, messages on that 
+ * thread use the module's log levels.
+ */
+static thread_local const CxxLogLevels *scoped_log_levels = nullptr;
+
+struct LogScope {
+    const CxxLogLevels *previous;
+    LogScope(const CxxLogLevels &log_levels) : previous(scoped_log_levels) {
+        scoped_log_levels = &log_levels;
+    }
+    ~LogScope() {
+        scoped_log_levels = previous;
+    }
+};
+
+/**
+ * Times calls with the monotonic clock, in nanoseconds.
+ */
+static inline uint64_t monotonic_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double seconds_since(uint64_t start_nanoseconds) {
+    return (monotonic_nanoseconds() - start_nanoseconds) * 1e-9;
+}
+
+/**
+ * Call times are counted in a histogram with four buckets per octave of 
+ * nanoseconds, from which percentiles are estimated to within about 10%. 
+ * The last bucket counts all calls longer than about 9 minutes.
+ */
+static constexpr int call_time_bucket_count = 160;
+
+static inline int call_time_bucket(uint64_t nanoseconds) {
+    if (nanoseconds < 4) {
+        return int(nanoseconds);
+    }
+#if defined(_MSC_VER)
+    unsigned long octave;
+    _BitScanReverse64(&octave, nanoseconds);
+#else
+    int octave = 63 - __builtin_clzll(nanoseconds);
+#endif
+    int bucket = 4 * (int(octave) - 1) + int((nanoseconds >> (octave - 2)) & 3);
+    return std::min(bucket, call_time_bucket_count - 1);
+}
+
+/**
+ * Returns the nanoseconds in the middle of a histogram bucket.
+ */
+static double call_time_bucket_middle(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int octave = bucket / 4 + 1;
+    double width = std::ldexp(1.0, octave - 2);
+    return (4 + bucket % 4) * width + width / 2;
+}
+
+/**
+ * Call times accumulated by one `cxx_invoke` instance, without atomic 
+ * operations, to be merged into its factory's `CallStats` from time to 
+ * time, so that instances on different threads (`-j`) do not contend for 
+ * the same cache lines on every call.
+ */
+struct CallTimes {
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t minimum = UINT64_MAX;
+    uint64_t maximum = 0;
+    uint32_t buckets[call_time_bucket_count] = {};
+    inline void add(uint64_t nanoseconds) {
+        count++;
+        total += nanoseconds;
+        minimum = std::min(minimum, nanoseconds);
+        maximum = std::max(maximum, nanoseconds);
+        buckets[call_time_bucket(nanoseconds)]++;
+    }
+};
+
+/**
+ * Call times for one kind of call (`init`, `kontrol`, or `noteoff`) of all 
+ * instances of one factory. May be updated from any thread.
+ */
+struct CallStats {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> minimum{UINT64_MAX};
+    std::atomic<uint64_t> maximum{0};
+    std::atomic<uint64_t> buckets[call_time_bucket_count] = {};
+    void add(uint64_t nanoseconds) {
+        CallTimes times;
+        times.add(nanoseconds);
+        merge(times);
+    }
+    /**
+     * Adds the times to these statistics and clears them.
+     */
+    void merge(CallTimes &times) {
+        if (times.count == 0) {
+            return;
+        }
+        count.fetch_add(times.count, std::memory_order_relaxed);
+        total.fetch_add(times.total, std::memory_order_relaxed);
+        auto minimum_ = minimum.load(std::memory_order_relaxed);
+        while (times.minimum < minimum_ && minimum.compare_exchange_weak(minimum_, times.minimum, std::memory_order_relaxed) == false) {
+        }
+        auto maximum_ = maximum.load(std::memory_order_relaxed);
+        while (times.maximum > maximum_ && maximum.compare_exchange_weak(maximum_, times.maximum, std::memory_order_relaxed) == false) {
+        }
+        for (int bucket = 0; bucket < call_time_bucket_count; ++bucket) {
+            if (times.buckets[bucket] != 0) {
+                buckets[bucket].fetch_add(times.buckets[bucket], std::memory_order_relaxed);
+            }
+        }
+        times = CallTimes();
+    }
+    /**
+     * Returns the estimated time in seconds within which the fraction of 
+     * calls completed.
+     */
+    double percentile(double fraction) const {
+        auto count_ = count.load(std::memory_order_relaxed);
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = uint64_t(std::ceil(fraction * count_));
+        uint64_t counted = 0;
+        for (int bucket = 0; bucket < call_time_bucket_count; ++bucket) {
+            counted += buckets[bucket].load(std::memory_order_relaxed);
+            if (counted >= rank) {
+                return std::min<double>(call_time_bucket_middle(bucket), maximum.load(std::memory_order_relaxed)) * 1e-9;
+            }
+        }
+        return maximum.load(std::memory_order_relaxed) * 1e-9;
+    }
+    /**
+     * Writes count, total, mean, minimum, maximum, and the 50th, 90th, and 
+     * 99th percentiles, all in seconds except the count.
+     */
+    void report(MYFLT *values) const {
+        auto count_ = count.load(std::memory_order_relaxed);
+        double total_ = total.load(std::memory_order_relaxed) * 1e-9;
+        values[0] = MYFLT(count_);
+        values[1] = total_;
+        values[2] = count_ > 0 ? total_ / count_ : 0;
+        values[3] = count_ > 0 ? minimum.load(std::memory_order_relaxed) * 1e-9 : 0;
+        values[4] = maximum.load(std::memory_order_relaxed) * 1e-9;
+        values[5] = percentile(0.5);
+        values[6] = percentile(0.9);
+        values[7] = percentile(0.99);
+    }
+};
+
+/**
+ * A module compiled and loaded by these opcodes. A module that has been 
+ * replaced by `cxx_recompile` is retired: it is no longer searched for 
+ * factories, and it is unloaded once no instance of any of its factories 
+ * remains. The object itself is kept until the opcodes are destroyed, 
+ * because factory records, and `cxx_invoke` call sites holding a record 
+ * that has just been superseded, may still try to acquire it.
+ */
+struct LoadedModule {
+    void *handle = nullptr;
+    std::string entry_point;
+    int version = 1;
+    // The `CXX_INVOKABLE_INTERFACE_VERSION` that the module exports, or 0 if 
+    // it does not include `cxx_invokable.hpp`, or includes a version of it 
+    // that does not export one; its factories are then never registered, 
+    // and the first attempt is reported.
+    int interface_version = 0;
+    bool factories_refused = false;
+    // Handles of the dependencies that were loaded for the module, in load 
+    // order; each was loaded separately, so each must be unloaded.
+    std::vector<void *> dependency_handles;
+    // Whether the module is shared with other Csound instances.
+    bool shared = false;
+    // Wall times in seconds for running the compiler (or finding the 
+    // module in the cache), for loading the module, and for its entry point.
+    double compile_seconds = 0;
+    double load_seconds = 0;
+    double entry_point_seconds = 0;
+    // From the compiler command that built the module.
+    CxxLogLevels log_levels;
+    // How the module was built, so that it can be built again with 
+    // compile-time parameters (see `CxxSpecialization`).
+    std::string source_code;
+    std::string compiler_command;
+    std::string dynamic_link_libraries;
+    // For a specialized version of a module, the name under which its 
+    // factory is registered; empty for all other modules.
+    std::string specialization;
+    // Non-null if the module was built with `-+cxx_rtcheck`; the deadline of 
+    // each `kontrol` call is then this fraction of the kperiod.
+    cxx_rt_check_scope_t rt_check = nullptr;
+    double rt_check_deadline = 1;
+    // Whether `cxx_invoke` times each `kontrol` call of the module's 
+    // factories: if the module was built with `-+cxx_stats` or 
+    // `-+cxx_rtcheck`.
+    bool time_kontrol = false;
+    // One reference is held for the factory registry until the module is 
+    // retired, and one by each live instance of any of its factories.
+    std::atomic<long> references{1};
+    std::atomic<bool> retired{false};
+};
+
+/**
+ * The handles of a module that has been compiled and loaded, but not yet 
+ * published.
+ */
+struct BuiltModule {
+    void *handle = nullptr;
+    std::vector<void *> dependency_handles;
+    // Whether the module is a shared module (see below).
+    bool shared = false;
+    double compile_seconds = 0;
+    double load_seconds = 0;
+    CxxLogLevels log_levels;
+    std::string source_code;
+    std::string compiler_command;
+    std::string dynamic_link_libraries;
+};
+
+/**
+ * A module built with the `-+cxx_share` option, which any Csound instance in 
+ * the process that builds the same module with the same option uses instead 
+ * of building its own. Each instance still publishes the module, and calls 
+ * its entry point, in its own registry; only the code and the static data 
+ * of the module are shared.
+ */
+struct SharedModule {
+    void *handle = nullptr;
+    std::vector<void *> dependency_handles;
+    // The number of Csound instances that are using the module.
+    long references = 0;
+};
+
+static std::mutex &shared_modules_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+/**
+ * Shared modules by the hash of everything that goes into building them.
+ */
+static std::map<std::string, SharedModule> &shared_modules() {
+    static std::map<std::string, SharedModule> shared_modules_;
+    return shared_modules_;
+}
+
+/**
+ * Releases one reference to a shared module, and unloads it and its 
+ * dependencies when no Csound instance is using it any more.
+ */
+static void release_shared_module(void *module_handle) {
+    SharedModule released;
+    {
+        std::lock_guard<std::mutex> lock(shared_modules_mutex());
+        auto it = std::find_if(shared_modules().begin(), shared_modules().end(), [module_handle] (const std::pair<const std::string, SharedModule> &entry) {
+            return entry.second.handle == module_handle;
+        });
+        if (it == shared_modules().end() || --it->second.references > 0) {
+            return;
+        }
+        released = std::move(it->second);
+        shared_modules().erase(it);
+    }
+    unload_module_handle(released.handle);
+    for (auto it = released.dependency_handles.rbegin(); it != released.dependency_handles.rend(); ++it) {
+        if (*it != nullptr) {
+            unload_module_handle(*it);
+        }
+    }
+}
+
+/**
+ * Unloads a module, and then its dependencies in reverse load order. Must 
+ * never be called on a Csound performance thread.
+ */
+static void unload_module(void *module_handle, std::vector<void *> &dependency_handles, bool shared = false) {
+    if (module_handle != nullptr) {
+        if (shared) {
+            release_shared_module(module_handle);
+        } else {
+            unload_module_handle(module_handle);
+        }
+    }
+    for (auto it = dependency_handles.rbegin(); it != dependency_handles.rend(); ++it) {
+        if (*it != nullptr) {
+            unload_module_handle(*it);
+        }
+    }
+    dependency_handles.clear();
+}
+
+/**
+ * Takes a reference to a module for a new instance of one of its factories. 
+ * Fails if the module has been retired and its last instance has ended, as 
+ * the module may then already have been unloaded; once a module has no 
+ * references, it never gets any again. Lock-free.
+ */
+static bool acquire_module(LoadedModule *module) {
+    auto references = module->references.load(std::memory_order_relaxed);
+    while (references > 0) {
+        if (module->references.compare_exchange_weak(references, references + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Drops a reference to a module. Never unloads the module, so is safe to 
+ * call on a Csound performance thread. Lock-free.
+ */
+static void release_module(LoadedModule *module) {
+    module->references.fetch_sub(1, std::memory_order_release);
+}
+
+/**
+ * Returns the address of a symbol in a module, whether the module was 
+ * loaded by the dynamic loader or compiled by the in-process backend.
+ */
+static void *module_symbol(CSOUND *csound, void *module_handle, const char *symbol_name) {
+#if defined(CXX_OPCODES_JIT)
+    if (cxx_jit_is_module(module_handle)) {
+        return cxx_jit_symbol(module_handle, symbol_name);
+    }
+#endif
+    return csound->GetLibrarySymbol(module_handle, symbol_name);
+}
+
+/**
+ * 64 bit FNV-1a hash, used to derive content addresses for the module cache.
+ * Successive calls may be chained by passing the previous hash.
+ */
+static uint64_t fnv1a(const std::string &data, uint64_t hash = 14695981039346656037ULL) {
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Returns the output of `<compiler> --version`, which is part of the module
+ * cache key so that upgrading the toolchain invalidates cached modules. This
+ * is computed once per compiler per process.
+ */
+static std::string compiler_version(const std::string &compiler) {
+    static std::mutex mutex_;
+    static std::map<std::string, std::string> versions;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = versions.find(compiler);
+    if (it != versions.end()) {
+        return it->second;
+    }
+    std::string version;
+    std::string command = compiler + " --version 2>&1";
+    auto pipe = popen(command.c_str(), "r");
+    if (pipe != nullptr) {
+        char buffer[0x100];
+        size_t count;
+        while ((count = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+            version.append(buffer, count);
+        }
+        pclose(pipe);
+    }
+    versions[compiler] = version;
+    return version;
+}
+
+/**
+ * Identifies the binary interface between these opcodes and the modules
+ * they compile, which is also part of the module cache key.
+ */
+static std::string csound_abi() {
+    char buffer[0x100];
+#if defined(USE_DOUBLE)
+    int use_double = 1;
+#else
+    int use_double = 0;
+#endif
+    std::snprintf(buffer, sizeof(buffer), "MYFLT=%d USE_DOUBLE=%d CS_VERSION=%d.%d CS_APIVERSION=%d.%d CXX_INVOKABLE_INTERFACE_VERSION=%d",
+        (int) sizeof(MYFLT), use_double, CS_VERSION, CS_SUBVER, CS_APIVERSION, CS_APISUBVER, CXX_INVOKABLE_INTERFACE_VERSION);
+    return buffer;
+}
+
+/**
+ * The headers that define the interface between these opcodes and their 
+ * modules.
+ */
+static const char *interface_headers[] = {"cxx_invokable.hpp", "csdl.h"};
+
+/**
+ * Returns a hash of the contents of the `interface_headers` that a compiler 
+ * command would include: each one is looked for in the command's `-I` and 
+ * `-isystem` directories, in `CPLUS_INCLUDE_PATH` and `CPATH`, and in the 
+ * usual system include directories. A header that is not found does not 
+ * change the hash. This is part of the module cache key and of the names of 
+ * precompiled headers, so that changing these headers, which neither the 
+ * cache nor the compiler checks, invalidates modules and precompiled headers 
+ * compiled against the old ones.
+ */
+static uint64_t interface_headers_hash(const std::string &compiler_command) {
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    std::vector<std::string> directories;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        for (auto prefix : {"-I", "-isystem"}) {
+            auto length = std::strlen(prefix);
+            if (tokens[i].compare(0, length, prefix) != 0) {
+                continue;
+            }
+            if (tokens[i].size() > length) {
+                directories.push_back(tokens[i].substr(length));
+            } else if (i + 1 < tokens.size()) {
+                directories.push_back(tokens[++i]);
+            }
+            break;
+        }
+    }
+    for (auto variable : {"CPLUS_INCLUDE_PATH", "CPATH"}) {
+        auto value = std::getenv(variable);
+        if (value != nullptr) {
+#if defined(WIN32)
+            tokenize(value, ';', directories);
+#else
+            tokenize(value, ':', directories);
+#endif
+        }
+    }
+    directories.push_back("/usr/local/include");
+    directories.push_back("/usr/local/include/csound");
+    directories.push_back("/usr/include");
+    directories.push_back("/usr/include/csound");
+    uint64_t hash = fnv1a(std::string());
+    std::error_code error_code;
+    for (auto header : interface_headers) {
+        for (const auto &directory : directories) {
+            auto filepath = std::filesystem::path(directory) / header;
+            if (directory.empty() || std::filesystem::is_regular_file(filepath, error_code) == false) {
+                continue;
+            }
+            std::string contents;
+            auto file_ = std::fopen(filepath.string().c_str(), "rb");
+            if (file_ != nullptr) {
+                char buffer[0x1000];
+                size_t count;
+                while ((count = std::fread(buffer, 1, sizeof(buffer), file_)) > 0) {
+                    contents.append(buffer, count);
+                }
+                std::fclose(file_);
+            }
+            hash = fnv1a(header, hash);
+            hash = fnv1a(contents, hash);
+            break;
+        }
+    }
+    return hash;
+}
+
+/**
+ * Configuration of the persistent, content-addressed cache of compiled
+ * modules. If there is a cached module whose key matches the source code,
+ * compiler command, entry point, compiler version, Csound ABI, and interface 
+ * headers of a `cxx_compile` call, that module is loaded and the compiler is not run.
+ *
+ * The defaults can be overridden by the environment variables
+ * `CXX_OPCODES_CACHE_DIR` (an empty value disables the cache) and
+ * `CXX_OPCODES_CACHE_SIZE` (limit in megabytes, 0 for unlimited), or at run
+ * time by the `cxx_cache` opcode. When the limit is exceeded, the least
+ * recently used modules are evicted.
+ */
+struct ModuleCache {
+    std::string directory;
+    uintmax_t size_limit = uintmax_t(512) * 1024 * 1024;
+    bool enabled() const {
+        return directory.empty() == false;
+    }
+};
+
+static std::mutex &module_cache_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+static ModuleCache &module_cache() {
+    static ModuleCache module_cache_ = [] () {
+        ModuleCache cache;
+        auto directory = std::getenv("CXX_OPCODES_CACHE_DIR");
+        if (directory != nullptr) {
+            cache.directory = directory;
+        } else {
+            auto xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+            auto home = std::getenv("HOME");
+            if (xdg_cache_home != nullptr) {
+                cache.directory = std::string(xdg_cache_home) + "/csound-cxx-opcodes";
+            } else if (home != nullptr) {
+                cache.directory = std::string(home) + "/.cache/csound-cxx-opcodes";
+            } else {
+                cache.directory = (std::filesystem::temp_directory_path() / "csound-cxx-opcodes").string();
+            }
+        }
+        auto size_limit = std::getenv("CXX_OPCODES_CACHE_SIZE");
+        if (size_limit != nullptr) {
+            cache.size_limit = std::strtoull(size_limit, nullptr, 10) * 1024 * 1024;
+        }
+        return cache;
+    }();
+    return module_cache_;
+}
+
+/**
+ * Returns the cache key for a module as a hexadecimal string.
+ */
+static std::string module_cache_key(const std::string &source_code, const std::string &compiler_command, const std::string &entry_point) {
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    std::string compiler = tokens.empty() ? std::string() : tokens.front();
+    uint64_t hash = fnv1a(source_code);
+    hash = fnv1a(compiler_command, hash);
+    hash = fnv1a(entry_point, hash);
+    hash = fnv1a(compiler_version(compiler), hash);
+    hash = fnv1a(csound_abi(), hash);
+    char headers[0x20];
+    std::snprintf(headers, sizeof(headers), "%016llx", (unsigned long long) interface_headers_hash(compiler_command));
+    hash = fnv1a(headers, hash);
+    char key[0x20];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash);
+    return key;
+}
+
+/**
+ * Removes the least recently used modules from the cache directory until the
+ * total size of the cached modules is no greater than `target_size`. Returns
+ * the number of modules removed. The caller must hold `module_cache_mutex()`.
  */
-static std::vector<void *> &loaded_modules() {
-    static std::vector<void *> loaded_modules_;
-    return loaded_modules_;
+static int evict_module_cache(const std::string &directory, uintmax_t target_size) {
+    std::error_code error_code;
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> modules;
+    uintmax_t total_size = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error_code)) {
+        const auto &path = entry.path();
+        if (path.extension() != ".so" || path.filename().string().rfind("cxx_", 0) != 0) {
+            continue;
+        }
+        total_size += entry.file_size(error_code);
+        modules.push_back({entry.last_write_time(error_code), path});
+    }
+    std::sort(modules.begin(), modules.end());
+    int removed = 0;
+    for (const auto &module : modules) {
+        if (total_size <= target_size) {
+            break;
+        }
+        auto size = std::filesystem::file_size(module.second, error_code);
+        if (std::filesystem::remove(module.second, error_code)) {
+            total_size -= size;
+            ++removed;
+        }
+    }
+    return removed;
 }
 
 /**
@@ -121,122 +803,3474 @@ extern "C" {
     typedef int (*csound_main_t)(CSOUND *csound);
 };
 
-static std::mutex &get_mutex() {
-    static std::mutex mutex_;
-    return mutex_;
-}
+/**
+ * A named factory. Records are never moved or deleted while the opcodes are 
+ * loaded, so `cxx_invoke` can keep a pointer to the record for its call 
+ * site, and re-resolve by name only if the name changes.
+ */
+struct FactoryRecord {
+    std::string name;
+    // The module that defines the factory.
+    LoadedModule *module;
+    // Set when the record has been removed from the registry because its 
+    // module was replaced or retired; call sites must then look up the 
+    // name again.
+    std::atomic<bool> superseded{false};
+    cxx_invokable_factory_t factory;
+    // Non-null if the module also exports `<name>_placement`.
+    const CxxPlacementFactory *placement;
+    // Non-null if the module also exports `<name>_dispatch`.
+    const CxxDispatch *dispatch;
+    // Non-null if the module also exports `<name>_specialization`, and is 
+    // not itself a specialized version.
+    const CxxSpecialization *specialization;
+    // Copied from the module when the record is registered, for 
+    // `cxx_stats`: a retired module is unloaded and freed once it has no 
+    // instances left, but its records are reported until the opcodes are 
+    // destroyed.
+    std::string entry_point;
+    int version = 1;
+    double compile_seconds = 0;
+    double load_seconds = 0;
+    double entry_point_seconds = 0;
+    bool rt_checked = false;
+    // The number of instances created by `cxx_invoke`, and the times of 
+    // their calls. See `cxx_stats`.
+    std::atomic<uint64_t> instances{0};
+    CallStats init_stats;
+    CallStats kontrol_stats;
+    CallStats noteoff_stats;
+    // For modules built with `-+cxx_rtcheck`: the number of calls to 
+    // functions that are not real-time safe, the number of `kontrol` calls 
+    // that missed their deadline, and the number of reports logged.
+    std::atomic<uint64_t> rt_violations{0};
+    std::atomic<uint64_t> deadline_misses{0};
+    std::atomic<uint64_t> rt_reports{0};
+};
 
-class CxxCompile : public csound::OpcodeBase<CxxCompile>
-{
-public:
-    // OUTPUTS
-    MYFLT *i_result;
-    // INPUTS
-    STRINGDAT *S_entry_point;
-    STRINGDAT *S_source_code;
-    // Compiler name and all compiler options except for source code filename,
-    // output name, and dynamic link libraries.
-    STRINGDAT *S_compiler_command;
-    // All dynamic link libraries required by the compiler command.
-    STRINGDAT *S_dynamic_link_libraries;
-    // STATE
+/**
+ * An immutable snapshot of the factory registry, mapping factory names to 
+ * records. The keys refer to the names in the records.
+ */
+struct FactoryRegistry {
+    std::unordered_map<std::string_view, FactoryRecord *> records;
+};
+
+/**
+ * A bounded, lock-free queue of messages from the performance threads, 
+ * which never wait for it or call `csound->Message` themselves. Any number 
+ * of threads may push messages; one background thread at a time drains 
+ * them. When the queue is full, messages are dropped and counted.
+ */
+struct LogRing {
+    static constexpr size_t slot_count = 256;
+    static constexpr size_t message_size = 248;
+    struct Slot {
+        // Equal to the write position when the slot is free, and to the 
+        // write position + 1 when it holds a message.
+        std::atomic<size_t> sequence;
+        char message[message_size];
+    };
+    Slot slots[slot_count];
+    std::atomic<size_t> write_position{0};
+    size_t read_position = 0;
+    std::atomic<uint64_t> dropped{0};
+    LogRing() {
+        for (size_t index = 0; index < slot_count; ++index) {
+            slots[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+    bool push(const char *format, va_list arguments) {
+        auto position = write_position.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &slot = slots[position % slot_count];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    std::vsnprintf(slot.message, message_size, format, arguments);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = write_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
     /**
-     * This is an i-time only opcode. Everything happens in init.
+     * Prints all queued messages, and then the number of messages dropped.
+     */
+    void drain(CSOUND *csound) {
+        for (;;) {
+            auto &slot = slots[read_position % slot_count];
+            if (slot.sequence.load(std::memory_order_acquire) != read_position + 1) {
+                break;
+            }
+            csound->Message(csound, "%s", slot.message);
+            slot.sequence.store(read_position + slot_count, std::memory_order_release);
+            ++read_position;
+        }
+        auto dropped_ = dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped_ > 0) {
+            csound->Message(csound, "cxx_opcodes: %llu messages were dropped.\n", (unsigned long long) dropped_);
+        }
+    }
+};
+
+/**
+ * A background thread that unloads retired modules once their last 
+ * instances have ended, so that no Csound performance thread ever waits for 
+ * the dynamic loader or for a module's static destructors. It also 
+ * drains the log ring, and ends offload jobs that were closed while a 
+ * worker was running them. It is started when the first module is published, 
+ * and stopped when the opcodes are destroyed.
+ */
+struct ModuleReaper {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+    bool stopping = false;
+};
+
+/**
+ * A counting semaphore that a Csound performance thread may post without 
+ * taking a lock.
+ */
+class WorkSemaphore {
+public:
+    WorkSemaphore() {
+#if defined(__APPLE__)
+        semaphore = dispatch_semaphore_create(0);
+#elif defined(WIN32)
+        semaphore = CreateSemaphoreA(nullptr, 0, LONG_MAX, nullptr);
+#else
+        sem_init(&semaphore, 0, 0);
+#endif
+    }
+    ~WorkSemaphore() {
+#if defined(__APPLE__)
+        dispatch_release(semaphore);
+#elif defined(WIN32)
+        CloseHandle(semaphore);
+#else
+        sem_destroy(&semaphore);
+#endif
+    }
+    void post() {
+#if defined(__APPLE__)
+        dispatch_semaphore_signal(semaphore);
+#elif defined(WIN32)
+        ReleaseSemaphore(semaphore, 1, nullptr);
+#else
+        sem_post(&semaphore);
+#endif
+    }
+    void wait() {
+#if defined(__APPLE__)
+        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+#elif defined(WIN32)
+        WaitForSingleObject(semaphore, INFINITE);
+#else
+        while (sem_wait(&semaphore) != 0 && errno == EINTR) {
+        }
+#endif
+    }
+private:
+#if defined(__APPLE__)
+    dispatch_semaphore_t semaphore;
+#elif defined(WIN32)
+    HANDLE semaphore;
+#else
+    sem_t semaphore;
+#endif
+};
+
+/**
+ * An instance whose `kontrol` runs on the offload pool (see 
+ * `cxx_invoke_offload`). At most one worker at a time runs a job, and a 
+ * worker runs it until it has no work left. The job is deleted when the 
+ * opcode has released it and no queued reference to it is left.
+ */
+struct OffloadJob {
+    // One reference is held by the opcode until noteoff, and one by each 
+    // entry for the job in the queue.
+    std::atomic<long> references{1};
+    // Held by the worker that is running the job.
+    std::atomic<bool> busy{false};
+    // Set at noteoff, after which no worker runs the job.
+    std::atomic<bool> closed{false};
+    // Set by the first call of `take_end`.
+    std::atomic<bool> finished{false};
+    // Links the jobs that workers have left to be ended (see 
+    // `OffloadPool::ended_jobs`).
+    OffloadJob *next_ended = nullptr;
+    virtual ~OffloadJob() {}
+    virtual void run() = 0;
+    virtual bool has_work() const = 0;
+    /**
+     * Returns true to the first caller only, which must then see that the 
+     * job is ended after it has been closed: noteoff, if no worker is 
+     * running the job, and otherwise the worker when it stops, so that 
+     * noteoff never waits for a worker.
+     */
+    bool take_end() {
+        return finished.exchange(true) == false;
+    }
+    virtual void end() = 0;
+};
+
+static void release_offload_job(OffloadJob *job) {
+    if (job->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete job;
+    }
+}
+
+/**
+ * A bounded, lock-free queue of jobs that any thread may push and pop 
+ * (Vyukov's bounded MPMC queue).
+ */
+struct OffloadQueue {
+    static constexpr size_t slot_count = 1024;
+    struct Slot {
+        std::atomic<size_t> sequence;
+        OffloadJob *job;
+    };
+    Slot slots[slot_count];
+    std::atomic<size_t> write_position{0};
+    std::atomic<size_t> read_position{0};
+    OffloadQueue() {
+        for (size_t index = 0; index < slot_count; ++index) {
+            slots[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+    bool push(OffloadJob *job) {
+        auto position = write_position.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &slot = slots[position % slot_count];
+            auto difference = intptr_t(slot.sequence.load(std::memory_order_acquire)) - intptr_t(position);
+            if (difference == 0) {
+                if (write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.job = job;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = write_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    OffloadJob *pop() {
+        auto position = read_position.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &slot = slots[position % slot_count];
+            auto difference = intptr_t(slot.sequence.load(std::memory_order_acquire)) - intptr_t(position + 1);
+            if (difference == 0) {
+                if (read_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    auto job = slot.job;
+                    slot.sequence.store(position + slot_count, std::memory_order_release);
+                    return job;
+                }
+            } else if (difference < 0) {
+                return nullptr;
+            } else {
+                position = read_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+/**
+ * Worker threads, at real-time priority where the system allows it, that 
+ * run the `kontrol` of `cxx_invoke_offload` instances. The pool is started 
+ * by the first such instance, and stopped when the opcodes are destroyed.
+ */
+struct OffloadPool {
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    OffloadQueue queue;
+    WorkSemaphore semaphore;
+    std::atomic<bool> stopping{false};
+    // A lock-free stack of jobs that were closed while a worker was running 
+    // them. The worker does not end them itself, because ending a job calls 
+    // the module's `noteoff`; the module reaper ends them.
+    std::atomic<OffloadJob *> ended_jobs{nullptr};
+};
+
+/**
+ * A channel opened by modules through the `CxxChannelRegistry`, with the 
+ * memory of its elements.
+ */
+struct ChannelRecord {
+    CxxChannelState state{};
+    std::string name;
+    size_t references = 0;
+    std::unique_ptr<std::atomic<size_t>[]> sequences;
+    size_t alignment = 0;
+    ~ChannelRecord() {
+        if (state.elements != nullptr) {
+            ::operator delete(state.elements, std::align_val_t(alignment));
+        }
+    }
+};
+
+/**
+ * The modules and the factory registry of one Csound instance. The state is 
+ * kept in a Csound global variable, so that each Csound instance unloads 
+ * its own modules, and frees its own registry, when it is destroyed or 
+ * reset.
+ */
+struct CxxOpcodesState {
+    // Serializes changes to `loaded_modules` and the factory registry. It is 
+    // never taken on the per-note path of `cxx_invoke` once a factory has 
+    // been registered: `cxx_invoke` instances running on different Csound 
+    // threads (`-j`) read the registry without locking.
+    std::mutex registry_mutex;
+    // All modules compiled and loaded by this Csound instance, in load 
+    // order.
+    std::vector<std::unique_ptr<LoadedModule>> loaded_modules;
+    // Retired modules that have been unloaded; see `LoadedModule`.
+    std::vector<std::unique_ptr<LoadedModule>> unloaded_modules;
+    // The current snapshot of the factory registry. Readers load it without 
+    // locking. Writers hold `registry_mutex`, copy the snapshot, change the 
+    // copy, and publish the copy; replaced snapshots are retired rather than 
+    // deleted, because a reader may still be using one. Readers count 
+    // themselves in `registry_readers` while they use a snapshot, and the 
+    // module reaper deletes the retired snapshots when it sees no readers 
+    // (see `reclaim_factory_registries`).
+    std::atomic<const FactoryRegistry *> factory_registry{nullptr};
+    std::atomic<long> registry_readers{0};
+    std::vector<std::unique_ptr<const FactoryRegistry>> retired_factory_registries;
+    std::vector<std::unique_ptr<FactoryRecord>> factory_records;
+    // Unloads retired modules, and drains `log_ring`.
+    ModuleReaper module_reaper;
+    CSOUND *csound = nullptr;
+    // For messages that do not concern one module.
+    CxxLogLevels log_levels;
+    LogRing log_ring;
+    // The names of the specialized factories that have been requested (see 
+    // `CxxSpecialization`), whether or not they have been built yet.
+    std::mutex specializations_mutex;
+    std::unordered_set<std::string> specializations;
+    OffloadPool offload_pool;
+    // The channels that modules share (see `CxxChannelRegistry`), by name.
+    std::mutex channels_mutex;
+    std::unordered_map<std::string, std::unique_ptr<ChannelRecord>> channels;
+    // This instance's copies of the bundles that it loads modules from (see 
+    // `private_bundle`), by bundle; removed when the instance is destroyed.
+    std::mutex bundle_copies_mutex;
+    std::map<std::string, std::string> bundle_copies;
+};
+
+static const char *opcodes_state_name = "cxx_opcodes_state";
+
+/**
+ * Creates the state for a Csound instance, if it does not yet exist. Called 
+ * when the opcodes are initialized for the instance.
+ */
+static CxxOpcodesState &create_opcodes_state(CSOUND *csound) {
+    static std::mutex mutex_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto variable = (CxxOpcodesState **) csound->QueryGlobalVariable(csound, opcodes_state_name);
+    if (variable == nullptr) {
+        csound->CreateGlobalVariable(csound, opcodes_state_name, sizeof(CxxOpcodesState *));
+        variable = (CxxOpcodesState **) csound->QueryGlobalVariable(csound, opcodes_state_name);
+    }
+    if (*variable == nullptr) {
+        *variable = new CxxOpcodesState;
+        (*variable)->csound = csound;
+        auto log_levels = std::getenv("CXX_OPCODES_LOG");
+        if (log_levels != nullptr) {
+            parse_log_levels(log_levels, (*variable)->log_levels);
+        }
+    }
+    return **variable;
+}
+
+static CxxOpcodesState &opcodes_state(CSOUND *csound) {
+    auto variable = (CxxOpcodesState **) csound->QueryGlobalVariable(csound, opcodes_state_name);
+    if (variable == nullptr || *variable == nullptr) {
+        return create_opcodes_state(csound);
+    }
+    return **variable;
+}
+
+/**
+ * Returns whether messages of a level and category are enabled, in the 
+ * module being built or published on this thread, or else in the Csound 
+ * instance.
+ */
+static bool log_enabled(CSOUND *csound, CxxLogCategory category, CxxLogLevel level) {
+    if (level > CXX_OPCODES_MAX_LOG_LEVEL) {
+        return false;
+    }
+    if (scoped_log_levels != nullptr) {
+        return scoped_log_levels->enabled(category, level);
+    }
+    return opcodes_state(csound).log_levels.enabled(category, level);
+}
+
+/**
+ * Queues a message from a performance thread, to be printed by the 
+ * background thread of the Csound instance.
+ */
+static void log_from_performance(CSOUND *csound, const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    opcodes_state(csound).log_ring.push(format, arguments);
+    va_end(arguments);
+}
+
+/**
+ * Lock-free lookup of a registered factory by name. Returns nullptr if the 
+ * name has not been registered.
+ */
+static FactoryRecord *lookup_factory_record(CxxOpcodesState &state, const char *invokable_factory_name) {
+    FactoryRecord *record = nullptr;
+    state.registry_readers.fetch_add(1);
+    auto registry = state.factory_registry.load();
+    if (registry != nullptr) {
+        auto it = registry->records.find(std::string_view(invokable_factory_name));
+        if (it != registry->records.end()) {
+            record = it->second;
+        }
+    }
+    state.registry_readers.fetch_sub(1);
+    return record;
+}
+
+/**
+ * Deletes the retired snapshots of the factory registry, if no reader is 
+ * using any snapshot. A reader counts itself before it loads the current 
+ * snapshot, and every retired snapshot was replaced before the count is 
+ * read here, so a reader that is not counted can only see a snapshot that 
+ * has not been retired. Otherwise, the snapshots are left for the next 
+ * call. Must never be called on a Csound performance thread.
+ */
+static void reclaim_factory_registries(CxxOpcodesState &state) {
+    std::lock_guard<std::mutex> lock(state.registry_mutex);
+    if (state.retired_factory_registries.empty() == false && state.registry_readers.load() == 0) {
+        state.retired_factory_registries.clear();
+    }
+}
+
+/**
+ * Registers a factory, unless a factory with the same name has already been 
+ * registered, in which case the existing record wins, as the first loaded 
+ * module always has; or, if `replace` is true, the new record replaces the 
+ * existing record, which is superseded. The factory's companion functions 
+ * are looked up by `symbol_name`, if it is given, rather than by the name of 
+ * the factory. Returns the record for the name. The caller must hold the 
+ * registry mutex.
+ */
+static FactoryRecord *register_factory(CSOUND *csound, LoadedModule *module, const char *invokable_factory_name, cxx_invokable_factory_t invokable_factory, bool replace = false, const char *symbol_name = nullptr) {
+    auto &state = opcodes_state(csound);
+    auto existing_record = lookup_factory_record(state, invokable_factory_name);
+    if (existing_record != nullptr && (replace == false || existing_record->module == module)) {
+        return existing_record;
+    }
+    if (module->interface_version != CXX_INVOKABLE_INTERFACE_VERSION) {
+        if (module->factories_refused == false) {
+            module->factories_refused = true;
+            csound->Message(csound, "Error: cxx_invoke: factory \"%s\" is in a module that was not compiled against version %d of cxx_invokable.hpp; not using its factories.\n", invokable_factory_name, CXX_INVOKABLE_INTERFACE_VERSION);
+        }
+        return existing_record;
+    }
+    auto module_handle = module->handle;
+    auto record = std::make_unique<FactoryRecord>();
+    record->name = invokable_factory_name;
+    record->module = module;
+    record->factory = invokable_factory;
+    record->entry_point = module->entry_point;
+    record->version = module->version;
+    record->compile_seconds = module->compile_seconds;
+    record->load_seconds = module->load_seconds;
+    record->entry_point_seconds = module->entry_point_seconds;
+    record->rt_checked = module->rt_check != nullptr;
+    std::string symbol_prefix = symbol_name != nullptr ? symbol_name : invokable_factory_name;
+    record->placement = nullptr;
+    auto placement_name = symbol_prefix + "_placement";
+    auto placement = (cxx_invokable_placement_t) module_symbol(csound, module_handle, placement_name.c_str());
+    if (placement != nullptr) {
+        record->placement = placement();
+    }
+    record->dispatch = nullptr;
+    auto dispatch_name = symbol_prefix + "_dispatch";
+    auto dispatch = (cxx_invokable_dispatch_t) module_symbol(csound, module_handle, dispatch_name.c_str());
+    if (dispatch != nullptr) {
+        record->dispatch = dispatch();
+    }
+    record->specialization = nullptr;
+    if (module->specialization.empty()) {
+        auto specialization_name = symbol_prefix + "_specialization";
+        auto specialization = (cxx_invokable_specialization_t) module_symbol(csound, module_handle, specialization_name.c_str());
+        if (specialization != nullptr) {
+            record->specialization = specialization();
+        }
+    }
+    auto record_ = record.get();
+    state.factory_records.push_back(std::move(record));
+    auto current_registry = state.factory_registry.load(std::memory_order_acquire);
+    auto new_registry = std::make_unique<FactoryRegistry>();
+    if (current_registry != nullptr) {
+        new_registry->records = current_registry->records;
+    }
+    new_registry->records[std::string_view(record_->name)] = record_;
+    state.factory_registry.store(new_registry.release(), std::memory_order_release);
+    if (current_registry != nullptr) {
+        state.retired_factory_registries.emplace_back(current_registry);
+    }
+    if (existing_record != nullptr) {
+        existing_record->superseded.store(true, std::memory_order_release);
+    }
+    return record_;
+}
+
+/**
+ * Registers all factories listed by a module's `cxx_invokable_factories` 
+ * function, if it has one. The caller must hold the registry mutex.
+ */
+static void register_module_factories(CSOUND *csound, LoadedModule *module, bool replace = false) {
+    auto module_handle = module->handle;
+    // A module in a bundle has its own name for the function (see 
+    // `CxxBundleEntry`).
+    auto bundled_symbol = module->entry_point + "_cxx_invokable_factories";
+    auto invokable_factories = (cxx_invokable_factories_t) module_symbol(csound, module_handle, bundled_symbol.c_str());
+    if (invokable_factories == nullptr) {
+        invokable_factories = (cxx_invokable_factories_t) module_symbol(csound, module_handle, "cxx_invokable_factories");
+    }
+    if (invokable_factories == nullptr) {
+        return;
+    }
+    for (auto entry = invokable_factories(); entry != nullptr && entry->name != nullptr; ++entry) {
+        register_factory(csound, module, entry->name, entry->factory, replace);
+        if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) csound->Message(csound, "####### cxx_compile: registered factory:  %s\n", entry->name);
+    }
+}
+
+/**
+ * Returns the record for the factory with the given name, or nullptr. 
+ * Registered factories are found without locking. Otherwise, the loaded 
+ * modules are searched once, in load order, and the first factory found is 
+ * registered, so that later notes find it without searching.
+ */
+static FactoryRecord *find_factory_record(CSOUND *csound, const char *invokable_factory_name) {
+    auto &state = opcodes_state(csound);
+    auto record = lookup_factory_record(state, invokable_factory_name);
+    if (record != nullptr) {
+        return record;
+    }
+    std::lock_guard<std::mutex> lock(state.registry_mutex);
+    record = lookup_factory_record(state, invokable_factory_name);
+    if (record != nullptr) {
+        return record;
+    }
+    for (auto &module : state.loaded_modules) {
+        if (module->retired || module->specialization.empty() == false) {
+            continue;
+        }
+        auto module_handle = module->handle;
+        if (module->log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_DEBUG)) csound->Message(csound, "####### cxx_invoke::init: library handle:          %p\n", module_handle);
+        auto invokable_factory = (cxx_invokable_factory_t) module_symbol(csound, module_handle, invokable_factory_name);
+        if (invokable_factory != nullptr) {
+            return register_factory(csound, module.get(), invokable_factory_name, invokable_factory);
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Retires a module: removes its factories from the registry, so that new 
+ * notes no longer use them, and drops the registry's reference to it. 
+ * Instances that already exist keep running on the module's code. The 
+ * caller must hold the registry mutex.
+ */
+static void retire_module(CxxOpcodesState &state, LoadedModule *module) {
+    auto current_registry = state.factory_registry.load(std::memory_order_acquire);
+    std::vector<FactoryRecord *> superseded_records;
+    if (current_registry != nullptr) {
+        auto new_registry = std::make_unique<FactoryRegistry>();
+        for (const auto &entry : current_registry->records) {
+            if (entry.second->module == module) {
+                superseded_records.push_back(entry.second);
+            } else {
+                new_registry->records.insert(entry);
+            }
+        }
+        state.factory_registry.store(new_registry.release(), std::memory_order_release);
+        state.retired_factory_registries.emplace_back(current_registry);
+    }
+    for (auto record : superseded_records) {
+        record->superseded.store(true, std::memory_order_release);
+    }
+    module->retired = true;
+    release_module(module);
+}
+
+/**
+ * Unloads retired modules that have no instances left. Once a retired 
+ * module has no references, it can never be acquired again, so nothing 
+ * but its handles and the strings for building it are released; the 
+ * object is kept in `unloaded_modules`. Returns the number of modules 
+ * unloaded. Must never be called on a Csound performance thread.
+ */
+static int reap_retired_modules(CxxOpcodesState &state) {
+    std::vector<LoadedModule *> reaped_modules;
+    {
+        std::lock_guard<std::mutex> lock(state.registry_mutex);
+        auto &modules = state.loaded_modules;
+        for (auto it = modules.begin(); it != modules.end(); ) {
+            auto &module = *it;
+            if (module->retired && module->references.load(std::memory_order_acquire) == 0) {
+                reaped_modules.push_back(module.get());
+                state.unloaded_modules.push_back(std::move(module));
+                it = modules.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto module : reaped_modules) {
+        unload_module(module->handle, module->dependency_handles, module->shared);
+        module->handle = nullptr;
+        module->dependency_handles.clear();
+        std::string().swap(module->source_code);
+        std::string().swap(module->compiler_command);
+        std::string().swap(module->dynamic_link_libraries);
+    }
+    return int(reaped_modules.size());
+}
+
+/**
+ * Leaves a closed job to be ended by `end_offload_jobs`, which holds a 
+ * reference to it until then. Lock-free.
+ */
+static void defer_offload_job_end(OffloadPool &pool, OffloadJob *job) {
+    job->references.fetch_add(1, std::memory_order_relaxed);
+    auto next = pool.ended_jobs.load(std::memory_order_relaxed);
+    do {
+        job->next_ended = next;
+    } while (pool.ended_jobs.compare_exchange_weak(next, job, std::memory_order_release, std::memory_order_relaxed) == false);
+}
+
+/**
+ * Ends the jobs that workers have left to be ended. Called by the module 
+ * reaper, and when the opcodes are destroyed; never on a worker or a 
+ * Csound performance thread.
+ */
+static void end_offload_jobs(OffloadPool &pool) {
+    auto job = pool.ended_jobs.exchange(nullptr, std::memory_order_acquire);
+    while (job != nullptr) {
+        auto next = job->next_ended;
+        job->end();
+        release_offload_job(job);
+        job = next;
+    }
+}
+
+/**
+ * Starts the background thread of a Csound instance, if it is not already 
+ * running, which every 100 ms ends the offload jobs that workers have left 
+ * to be ended, unloads retired modules, deletes retired snapshots of the 
+ * factory registry, and prints the messages queued by the performance 
+ * threads.
+ */
+static void start_module_reaper(CxxOpcodesState &state) {
+    auto &reaper = state.module_reaper;
+    std::lock_guard<std::mutex> lock(reaper.mutex);
+    if (reaper.thread.joinable()) {
+        return;
+    }
+    reaper.stopping = false;
+    reaper.thread = std::thread([&state] () {
+        auto &reaper = state.module_reaper;
+        std::unique_lock<std::mutex> lock(reaper.mutex);
+        while (reaper.stopping == false) {
+            reaper.condition.wait_for(lock, std::chrono::milliseconds(100));
+            lock.unlock();
+            end_offload_jobs(state.offload_pool);
+            reap_retired_modules(state);
+            reclaim_factory_registries(state);
+            state.log_ring.drain(state.csound);
+            lock.lock();
+        }
+    });
+}
+
+static void stop_module_reaper(CxxOpcodesState &state) {
+    auto &reaper = state.module_reaper;
+    {
+        std::lock_guard<std::mutex> lock(reaper.mutex);
+        reaper.stopping = true;
+    }
+    reaper.condition.notify_all();
+    if (reaper.thread.joinable()) {
+        reaper.thread.join();
+    }
+}
+
+/**
+ * The number of values returned by `cxx_stats`: the number of instances; 
+ * the compile, load, and entry point times of the module; and then, for 
+ * each of `init`, `kontrol`, and `noteoff`, the count, total, mean, 
+ * minimum, maximum, and 50th, 90th, and 99th percentile times of calls.
+ */
+static constexpr int cxx_stats_size = 4 + 3 * 8;
+
+static void report_factory_stats(const FactoryRecord *record, MYFLT *values) {
+    std::fill(values, values + cxx_stats_size, MYFLT(0));
+    if (record == nullptr) {
+        return;
+    }
+    values[0] = MYFLT(record->instances.load(std::memory_order_relaxed));
+    values[1] = record->compile_seconds;
+    values[2] = record->load_seconds;
+    values[3] = record->entry_point_seconds;
+    record->init_stats.report(values + 4);
+    record->kontrol_stats.report(values + 12);
+    record->noteoff_stats.report(values + 20);
+}
+
+/**
+ * Prints the statistics of every factory that has had instances, including 
+ * factories of replaced versions of modules, in microseconds.
+ */
+static void print_factory_stats(CSOUND *csound, CxxOpcodesState &state) {
+    for (const auto &record : state.factory_records) {
+        if (record->instances.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        MYFLT values[cxx_stats_size];
+        report_factory_stats(record.get(), values);
+        csound->Message(csound, "cxx_stats: %s (%s version %d): instances: %.0f compile: %.6f s load: %.6f s entry point: %.6f s\n", record->name.c_str(), record->entry_point.c_str(), record->version, values[0], values[1], values[2], values[3]);
+        static const char *call_names[] = {"init", "kontrol", "noteoff"};
+        for (int call = 0; call < 3; ++call) {
+            auto call_values = values + 4 + 8 * call;
+            csound->Message(csound, "cxx_stats: %s %-7s calls: %.0f total: %.3f mean: %.3f min: %.3f max: %.3f p50: %.3f p90: %.3f p99: %.3f us\n", record->name.c_str(), call_names[call], call_values[0], call_values[1] * 1e6, call_values[2] * 1e6, call_values[3] * 1e6, call_values[4] * 1e6, call_values[5] * 1e6, call_values[6] * 1e6, call_values[7] * 1e6);
+        }
+        if (record->rt_checked) {
+            csound->Message(csound, "cxx_stats: %s real-time violations: %llu deadline misses: %llu\n", record->name.c_str(), (unsigned long long) record->rt_violations.load(), (unsigned long long) record->deadline_misses.load());
+        }
+    }
+}
+
+/**
+ * Runs jobs from the pool's queue until the pool is stopped.
+ */
+static void run_offload_worker(OffloadPool &pool) {
+    for (;;) {
+        pool.semaphore.wait();
+        if (pool.stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        auto job = pool.queue.pop();
+        if (job == nullptr) {
+            continue;
+        }
+        // Whichever worker holds `busy` runs the job until it has no work 
+        // left, so that the instance is never called on two threads at once.
+        for (;;) {
+            if (job->busy.exchange(true)) {
+                break;
+            }
+            if (job->closed.load() == false) {
+                job->run();
+            }
+            job->busy.store(false);
+            if (job->closed.load()) {
+                // The opcode may have seen this worker running the job, and 
+                // left the job to be ended.
+                if (job->take_end()) {
+                    defer_offload_job_end(pool, job);
+                }
+                break;
+            }
+            if (job->has_work() == false) {
+                break;
+            }
+        }
+        release_offload_job(job);
+    }
+}
+
+/**
+ * Starts the worker threads of the pool, if they are not running yet: one 
+ * for every two hardware threads, or `CXX_OPCODES_OFFLOAD_THREADS`.
+ */
+static void start_offload_pool(OffloadPool &pool) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.threads.empty() == false) {
+        return;
+    }
+    size_t thread_count = std::max(1u, std::thread::hardware_concurrency() / 2);
+    auto threads = std::getenv("CXX_OPCODES_OFFLOAD_THREADS");
+    if (threads != nullptr && std::atoi(threads) > 0) {
+        thread_count = std::atoi(threads);
+    }
+    pool.stopping = false;
+    for (size_t index = 0; index < thread_count; ++index) {
+        pool.threads.emplace_back(run_offload_worker, std::ref(pool));
+#if defined(WIN32)
+        SetThreadPriority(pool.threads.back().native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION))
+        // Fails without the privilege, and the workers then run at normal 
+        // priority.
+        sched_param parameters{};
+        parameters.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+        pthread_setschedparam(pool.threads.back().native_handle(), SCHED_FIFO, &parameters);
+#endif
+    }
+}
+
+/**
+ * Stops and joins the worker threads, and drops the jobs left in the queue.
+ */
+static void stop_offload_pool(OffloadPool &pool) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.stopping.store(true, std::memory_order_release);
+    for (size_t index = 0; index < pool.threads.size(); ++index) {
+        pool.semaphore.post();
+    }
+    for (auto &thread : pool.threads) {
+        thread.join();
+    }
+    pool.threads.clear();
+    while (auto job = pool.queue.pop()) {
+        release_offload_job(job);
+    }
+}
+
+/**
+ * Queues a job to be run by a worker. If the queue is full, the job runs 
+ * the next time that it is submitted.
+ */
+static void submit_offload_job(OffloadPool &pool, OffloadJob *job) {
+    job->references.fetch_add(1, std::memory_order_relaxed);
+    if (pool.queue.push(job) == false) {
+        job->references.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+    pool.semaphore.post();
+}
+
+/**
+ * Opens a channel for a module, creating it if it does not exist (see 
+ * `CxxChannelRegistry`).
+ */
+static CxxChannelState *open_channel(CSOUND *csound, const char *name, const CxxChannelShape *shape) {
+    auto &state = opcodes_state(csound);
+    std::lock_guard<std::mutex> lock(state.channels_mutex);
+    auto &record = state.channels[name];
+    if (record) {
+        auto &existing = record->state.shape;
+        if (existing.kind != shape->kind || existing.element_size != shape->element_size || existing.element_alignment != shape->element_alignment || (shape->capacity != 0 && existing.capacity != shape->capacity)) {
+            if (log_enabled(csound, CXX_LOG_INVOKE, CXX_LOG_WARNING)) {
+                log_from_performance(csound, "cxx_opcodes: channel \"%s\" exists with another kind, element type, or capacity.\n", name);
+            }
+            return nullptr;
+        }
+        ++record->references;
+        return &record->state;
+    }
+    if (shape->capacity == 0 || shape->element_alignment == 0 || (shape->element_alignment & (shape->element_alignment - 1)) != 0) {
+        state.channels.erase(name);
+        return nullptr;
+    }
+    record.reset(new ChannelRecord);
+    record->name = name;
+    record->references = 1;
+    auto &channel = record->state;
+    channel.shape = *shape;
+    channel.stride = (shape->element_size + shape->element_alignment - 1) & ~(shape->element_alignment - 1);
+    // Elements are aligned to cache lines at least, so that a channel does 
+    // not share a cache line with anything else.
+    record->alignment = std::max<size_t>(shape->element_alignment, CXX_AUDIO_ALIGNMENT);
+    auto element_count = shape->kind == CXX_CHANNEL_BLOCK ? 2 * shape->capacity : shape->capacity;
+    auto bytes = std::max<size_t>(element_count * channel.stride, 1);
+    channel.elements = static_cast<unsigned char *>(::operator new(bytes, std::align_val_t(record->alignment)));
+    std::memset(channel.elements, 0, bytes);
+    if (shape->kind == CXX_CHANNEL_MPSC) {
+        record->sequences.reset(new std::atomic<size_t>[shape->capacity]);
+        for (size_t index = 0; index < shape->capacity; ++index) {
+            record->sequences[index].store(index, std::memory_order_relaxed);
+        }
+        channel.sequences = record->sequences.get();
+    }
+    channel.write_position.store(0, std::memory_order_relaxed);
+    channel.read_position.store(0, std::memory_order_relaxed);
+    if (log_enabled(csound, CXX_LOG_INVOKE, CXX_LOG_DEBUG)) {
+        log_from_performance(csound, "####### cxx_opcodes: created channel \"%s\" kind: %d element size: %zu capacity: %zu\n", name, shape->kind, shape->element_size, shape->capacity);
+    }
+    return &channel;
+}
+
+/**
+ * Closes a channel opened by `open_channel`, and frees it when it is no 
+ * longer open anywhere.
+ */
+static void close_channel(CSOUND *csound, CxxChannelState *channel) {
+    auto &state = opcodes_state(csound);
+    std::lock_guard<std::mutex> lock(state.channels_mutex);
+    for (auto it = state.channels.begin(); it != state.channels.end(); ++it) {
+        if (&it->second->state == channel) {
+            if (--it->second->references == 0) {
+                state.channels.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+static const char *channel_registry_name = "cxx_channel_registry";
+
+/**
+ * Makes the channel registry available to modules, as a Csound global 
+ * variable that `cxx_channel_registry` finds.
+ */
+static void create_channel_registry(CSOUND *csound) {
+    if (csound->QueryGlobalVariable(csound, channel_registry_name) == nullptr) {
+        csound->CreateGlobalVariable(csound, channel_registry_name, sizeof(CxxChannelRegistry));
+    }
+    auto registry = (CxxChannelRegistry *) csound->QueryGlobalVariable(csound, channel_registry_name);
+    if (registry != nullptr) {
+        registry->open = &open_channel;
+        registry->close = &close_channel;
+    }
+}
+
+/**
+ * A file mapped into memory for modules (see `CxxMappedFileRegistry`).
+ */
+struct MappedFile {
+    std::string filepath;
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    long references = 0;
+#if defined(WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+/**
+ * The files mapped for modules, by canonical path; shared by all Csound 
+ * instances in the process.
+ */
+static std::mutex &mapped_files_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+static std::unordered_map<std::string, std::unique_ptr<MappedFile>> &mapped_files() {
+    static std::unordered_map<std::string, std::unique_ptr<MappedFile>> mapped_files_;
+    return mapped_files_;
+}
+
+/**
+ * Maps a file read-only into memory for a module, or returns the mapping 
+ * that already exists.
+ */
+static const unsigned char *map_file(CSOUND *csound, const char *filepath_, size_t *size) {
+    *size = 0;
+    std::error_code error_code;
+    auto filepath = std::filesystem::canonical(filepath_, error_code).string();
+    if (error_code) {
+        csound->Message(csound, "cxx_opcodes: cannot map \"%s\": %s\n", filepath_, error_code.message().c_str());
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mapped_files_mutex());
+    auto &mapped_file = mapped_files()[filepath];
+    if (mapped_file) {
+        ++mapped_file->references;
+        *size = mapped_file->size;
+        return mapped_file->data;
+    }
+    std::unique_ptr<MappedFile> new_file(new MappedFile);
+    new_file->filepath = filepath;
+#if defined(WIN32)
+    new_file->file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER file_size{};
+    if (new_file->file != INVALID_HANDLE_VALUE && GetFileSizeEx(new_file->file, &file_size) && file_size.QuadPart > 0) {
+        new_file->mapping = CreateFileMappingA(new_file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (new_file->mapping != nullptr) {
+            new_file->data = (const unsigned char *) MapViewOfFile(new_file->mapping, FILE_MAP_READ, 0, 0, 0);
+            new_file->size = size_t(file_size.QuadPart);
+        }
+    }
+    if (new_file->data == nullptr) {
+        if (new_file->mapping != nullptr) {
+            CloseHandle(new_file->mapping);
+        }
+        if (new_file->file != INVALID_HANDLE_VALUE) {
+            CloseHandle(new_file->file);
+        }
+    }
+#else
+    auto descriptor = open(filepath.c_str(), O_RDONLY);
+    struct stat status;
+    if (descriptor >= 0 && fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        auto data = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+        if (data != MAP_FAILED) {
+            new_file->data = (const unsigned char *) data;
+            new_file->size = size_t(status.st_size);
+        }
+    }
+    // The mapping stays valid after the file is closed.
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+#endif
+    if (new_file->data == nullptr) {
+        csound->Message(csound, "cxx_opcodes: cannot map \"%s\".\n", filepath.c_str());
+        mapped_files().erase(filepath);
+        return nullptr;
+    }
+    if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_opcodes: mapped file:        %s size: %zu\n", filepath.c_str(), new_file->size);
+    }
+    new_file->references = 1;
+    *size = new_file->size;
+    mapped_file = std::move(new_file);
+    return mapped_file->data;
+}
+
+/**
+ * Releases a mapping returned by `map_file`, and unmaps the file when no 
+ * module uses it any longer.
+ */
+static void unmap_file(CSOUND *csound, const unsigned char *data) {
+    std::lock_guard<std::mutex> lock(mapped_files_mutex());
+    for (auto it = mapped_files().begin(); it != mapped_files().end(); ++it) {
+        auto &mapped_file = *it->second;
+        if (mapped_file.data != data) {
+            continue;
+        }
+        if (--mapped_file.references == 0) {
+#if defined(WIN32)
+            UnmapViewOfFile(mapped_file.data);
+            CloseHandle(mapped_file.mapping);
+            CloseHandle(mapped_file.file);
+#else
+            munmap((void *) mapped_file.data, mapped_file.size);
+#endif
+            mapped_files().erase(it);
+        }
+        return;
+    }
+}
+
+static const char *mapped_file_registry_name = "cxx_mapped_file_registry";
+
+/**
+ * Makes the mapped file registry available to modules, as a Csound global 
+ * variable that `cxx_mapped_file_registry` finds.
+ */
+static void create_mapped_file_registry(CSOUND *csound) {
+    if (csound->QueryGlobalVariable(csound, mapped_file_registry_name) == nullptr) {
+        csound->CreateGlobalVariable(csound, mapped_file_registry_name, sizeof(CxxMappedFileRegistry));
+    }
+    auto registry = (CxxMappedFileRegistry *) csound->QueryGlobalVariable(csound, mapped_file_registry_name);
+    if (registry != nullptr) {
+        registry->map = &map_file;
+        registry->unmap = &unmap_file;
+    }
+}
+
+/**
+ * Discards all registered factories, and unloads all modules of a Csound 
+ * instance, newest first, with their dependencies; then frees the state of 
+ * the instance. Must only be called when no `cxx_invoke` instance can be 
+ * running, that is, when the opcodes are destroyed.
+ */
+static void destroy_opcodes_state(CSOUND *csound) {
+    auto variable = (CxxOpcodesState **) csound->QueryGlobalVariable(csound, opcodes_state_name);
+    if (variable == nullptr || *variable == nullptr) {
+        return;
+    }
+    auto state = *variable;
+    stop_offload_pool(state->offload_pool);
+    stop_module_reaper(*state);
+    end_offload_jobs(state->offload_pool);
+    state->log_ring.drain(csound);
+    print_factory_stats(csound, *state);
+    std::vector<std::unique_ptr<LoadedModule>> modules;
+    {
+        std::lock_guard<std::mutex> lock(state->registry_mutex);
+        delete state->factory_registry.exchange(nullptr);
+        state->retired_factory_registries.clear();
+        state->factory_records.clear();
+        state->unloaded_modules.clear();
+        modules.swap(state->loaded_modules);
+    }
+    for (auto it = modules.rbegin(); it != modules.rend(); ++it) {
+        auto &module = *it;
+        if (module->log_levels.enabled(CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+            csound->Message(csound, "####### cxx_opcodes: unloading module:   %s version: %d\n", module->entry_point.c_str(), module->version);
+        }
+        unload_module(module->handle, module->dependency_handles, module->shared);
+    }
+    for (const auto &bundle_copy : state->bundle_copies) {
+        std::error_code error_code;
+        std::filesystem::remove(bundle_copy.second, error_code);
+    }
+    csound->DestroyGlobalVariable(csound, channel_registry_name);
+    csound->DestroyGlobalVariable(csound, mapped_file_registry_name);
+    delete state;
+    *variable = nullptr;
+    csound->DestroyGlobalVariable(csound, opcodes_state_name);
+}
+
+/**
+ * As before, all diagnostics are enabled if the compiler command contains 
+ * the `-v` option, which is also passed on to the compiler.
+ */
+static bool has_verbose_option(const std::string &compiler_command) {
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    return std::find(tokens.begin(), tokens.end(), "-v") != tokens.end();
+}
+
+/**
+ * Removes every occurrence of a `-+cxx_...` option, which is for these 
+ * opcodes rather than for the compiler, from a compiler command. Returns 
+ * whether the option was present. If the option is given as 
+ * `option=value`, the value is returned in `value`.
+ */
+static bool strip_option(std::string &compiler_command, const std::string &option, std::string *value = nullptr) {
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    bool found = false;
+    std::string stripped;
+    for (const auto &token : tokens) {
+        if (token == option) {
+            found = true;
+            continue;
+        }
+        if (token.rfind(option + "=", 0) == 0) {
+            found = true;
+            if (value != nullptr) {
+                *value = token.substr(option.size() + 1);
+            }
+            continue;
+        }
+        if (stripped.empty() == false) {
+            stripped += ' ';
+        }
+        stripped += token;
+    }
+    if (found) {
+        compiler_command = stripped;
+    }
+    return found;
+}
+
+/**
+ * Sets the log levels of a module from its compiler command, and removes 
+ * any `-+cxx_log` options from the command.
+ */
+static void take_log_levels(std::string &compiler_command, CxxLogLevels &log_levels) {
+    if (has_verbose_option(compiler_command)) {
+        parse_log_levels("debug", log_levels);
+    }
+    std::string specification;
+    if (strip_option(compiler_command, "-+cxx_log", &specification)) {
+        parse_log_levels(specification, log_levels);
+    }
+    // Deprecated; see `cxx_module_diagnostics`.
+    cxx_diagnostics_enabled() = log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_DEBUG);
+}
+
+/**
+ * Returns the process id and random bytes chosen once per process, for the 
+ * names of files that processes in different containers or on different 
+ * hosts, which may have the same process ids, create in a shared directory.
+ */
+static const std::string &process_nonce() {
+    static const std::string nonce = [] {
+        std::random_device random;
+        char buffer[0x100];
+        std::snprintf(buffer, sizeof(buffer), "%ld_%08x%08x", (long) getpid(), random(), random());
+        return std::string(buffer);
+    }();
+    return nonce;
+}
+
+/**
+ * Returns the pathname of a new, empty file in the temporary directory, 
+ * which no other compilation, in this or any other process, uses: the name 
+ * contains the process nonce and a per-process counter, and the file is 
+ * created only if it does not exist. The caller overwrites and removes the 
+ * file. Returns an empty string if no file could be created.
+ */
+static std::string temporary_filepath(const char *extension) {
+    static std::atomic<unsigned long> counter{0};
+    auto directory = std::filesystem::temp_directory_path().string();
+    char filepath[0x500];
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        std::snprintf(filepath, sizeof(filepath), "%s/cxx_opcode_%s_%lu%s", directory.c_str(), process_nonce().c_str(), counter++, extension);
+        // "x" fails if the file already exists.
+        auto file_ = std::fopen(filepath, "wx");
+        if (file_ != nullptr) {
+            std::fclose(file_);
+            return filepath;
+        }
+    }
+    return std::string();
+}
+
+/**
+ * Writes the data to a pipe. If the reader has exited, e.g. a compiler that 
+ * rejected its options, the write fails with SIGPIPE, which by default 
+ * terminates the process; so SIGPIPE is blocked in this thread meanwhile, 
+ * and any SIGPIPE that the write raised is consumed. Returns false if not 
+ * all of the data were written.
+ */
+static bool write_to_pipe(FILE *pipe, const std::string &data) {
+#if defined(WIN32)
+    return std::fwrite(data.data(), 1, data.size(), pipe) == data.size() && std::fflush(pipe) == 0;
+#else
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    sigset_t old_mask;
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+    sigset_t pending;
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+    bool written = std::fwrite(data.data(), 1, data.size(), pipe) == data.size() && std::fflush(pipe) == 0;
+    if (was_pending == false) {
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE)) {
+            int signal_;
+            sigwait(&sigpipe, &signal_);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    return written;
+#endif
+}
+
+/**
+ * Compiles the source code to a module, or finds the module in the cache. 
+ * Returns 0 on success, with the pathname of the module in 
+ * `module_filepath`, or else the result of the compiler command. If 
+ * `use_stdin` is true, the source code is piped to the compiler rather than 
+ * written to a file. If `work_directory` is not empty, the source file and 
+ * the module are given fixed names in that directory rather than temporary 
+ * names, and the source code is always written to the file. The source 
+ * file, if any, is always removed. If the module could not be moved into 
+ * the cache, `module_is_temporary` is set, and the caller should remove the 
+ * module once it has been loaded. Does not call into Csound except for 
+ * diagnostic messages, so may be called from any thread.
+ */
+static int compile_module(CSOUND *csound, const std::string &entry_point, const std::string &source_code, const std::string &compiler_command_, bool use_stdin, std::string &module_filepath_, bool &module_is_temporary, const std::string &work_directory = std::string()) {
+    // If the module is already in the cache, use it instead of compiling.
+    int result = OK;
+    module_is_temporary = false;
+    std::string cached_module_filepath;
+    bool cache_hit = false;
+    {
+        std::lock_guard<std::mutex> lock(module_cache_mutex());
+        if (module_cache().enabled()) {
+            std::error_code error_code;
+            std::filesystem::create_directories(module_cache().directory, error_code);
+            auto key = module_cache_key(source_code, compiler_command_, entry_point);
+            cached_module_filepath = module_cache().directory + "/cxx_" + key + ".so";
+            if (std::filesystem::exists(cached_module_filepath, error_code)) {
+                // Touching the module keeps it from being evicted.
+                std::filesystem::last_write_time(cached_module_filepath, std::filesystem::file_time_type::clock::now(), error_code);
+                cache_hit = true;
+            }
+        }
+    }
+    if (cache_hit) {
+        module_filepath_ = cached_module_filepath;
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+            csound->Message(csound, "####### cxx_compile: cache hit:          %s\n", module_filepath_.c_str());
+        }
+        return result;
+    }
+    std::error_code error_code;
+    auto module_filepath = work_directory.empty() ? temporary_filepath(".so") : work_directory + "/module.so";
+    if (module_filepath.empty()) {
+        csound->Message(csound, "Error: cxx_compile: could not create a temporary file in %s\n", std::filesystem::temp_directory_path(error_code).string().c_str());
+        return NOTOK;
+    }
+    std::string compiler_command;
+    std::string source_filepath;
+    if (work_directory.empty() == false) {
+        use_stdin = false;
+    }
+    if (use_stdin) {
+        compiler_command = compiler_command_ + " -x c++ - -o" + module_filepath;
+    } else {
+        // Create a temporary file containing the source code.
+        source_filepath = work_directory.empty() ? temporary_filepath(".cpp") : work_directory + "/module.cpp";
+        auto file_ = source_filepath.empty() ? nullptr : std::fopen(source_filepath.c_str(), "w");
+        if (file_ == nullptr) {
+            csound->Message(csound, "Error: cxx_compile: could not write %s\n", source_filepath.c_str());
+            std::filesystem::remove(module_filepath, error_code);
+            return NOTOK;
+        }
+        std::fwrite(source_code.data(), source_code.size(), sizeof(source_code[0]), file_);
+        std::fclose(file_);
+        compiler_command = compiler_command_ + " " + source_filepath + " -o" + module_filepath;
+    }
+    if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_compile: command:            %s\n", compiler_command.c_str());
+    }
+    if (use_stdin) {
+        auto pipe = popen(compiler_command.c_str(), "w");
+        if (pipe == nullptr) {
+            result = NOTOK;
+        } else {
+            bool written = write_to_pipe(pipe, source_code);
+            result = pclose(pipe);
+            if (written == false) {
+                csound->Message(csound, "Error: cxx_compile: could not pipe the source code of \"%s\" to the compiler.\n", entry_point.c_str());
+                if (result == 0) {
+                    result = NOTOK;
+                }
+            }
+        }
+    } else {
+        result = std::system(compiler_command.c_str());
+        std::filesystem::remove(source_filepath, error_code);
+    }
+    if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_compile: result:             %d\n", result);
+    }
+    if (result != 0) {
+        std::filesystem::remove(module_filepath, error_code);
+        return result;
+    }
+    // Move the new module into the cache. The rename is atomic, so 
+    // concurrent Csound processes never see a partially written module.
+    if (cached_module_filepath.empty() == false) {
+        std::lock_guard<std::mutex> lock(module_cache_mutex());
+        std::filesystem::rename(module_filepath, cached_module_filepath, error_code);
+        if (!error_code) {
+            module_filepath = cached_module_filepath;
+            if (module_cache().size_limit != 0) {
+                evict_module_cache(module_cache().directory, module_cache().size_limit);
+            }
+        }
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+            csound->Message(csound, "####### cxx_compile: cached module:      %s\n", module_filepath.c_str());
+        }
+    }
+    module_is_temporary = module_filepath != cached_module_filepath;
+    module_filepath_ = module_filepath;
+    return result;
+}
+
+/**
+ * First preloads the dynamic link libraries required by a compiled module, 
+ * then loads the module itself, all in global scope. Returns the handle of 
+ * the module, or nullptr on failure. The handles of the dependencies are 
+ * appended to `dependency_handles`. If the module filepath is empty, only 
+ * the dependencies are loaded. May be called from any thread.
+ */
+static void *load_module(CSOUND *csound, const std::string &module_filepath, const std::string &dynamic_link_libraries, std::vector<void *> &dependency_handles) {
+    std::vector<std::string> dynamic_link_library_names;
+    tokenize(dynamic_link_libraries, ' ', dynamic_link_library_names);
+    for (const auto &dynamic_link_library_name : dynamic_link_library_names) {
+        auto library_result = cxx_load_library(dynamic_link_library_name.c_str());
+#if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION)) 
+        if (library_result == nullptr) {
+                auto error_message = dlerror();
+                csound->Message(csound, "Error: dlerror: \"%s\" when trying to load %s\n", error_message, dynamic_link_library_name.c_str());
+        }
+#endif
+        if (library_result != nullptr) {
+            dependency_handles.push_back(library_result);
+            if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+                csound->Message(csound, "####### cxx_compile: loaded dependency:  %s\n", dynamic_link_library_name.c_str());
+            }
+        }
+    }
+    void *module_handle = nullptr;
+    if (module_filepath.empty()) {
+        return module_handle;
+    }
+    ///result = csound->OpenLibrary(&module_handle, module_filepath);
+    module_handle = cxx_load_library(module_filepath.c_str());
+#if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION)) 
+    ///if (result != OK) {
+    if (module_handle == nullptr) {
+            auto error_message = dlerror();
+            if (error_message != nullptr && std::strstr(error_message, "__wrap_") != nullptr) {
+                // With `-+cxx_rtcheck`, the module's calls to the checked 
+                // functions are linked to wrappers that only 
+                // `cxx_invokable.hpp` defines.
+                csound->Message(csound, "Error: cxx_compile: a module built with -+cxx_rtcheck must include cxx_invokable.hpp (dlerror: %s)\n", error_message);
+            } else {
+                csound->Message(csound, "Error: dlerror: %s\n", error_message);
+            }
+    }
+#endif
+    if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_compile: module_filepath:    %s\n", module_filepath.c_str());
+        csound->Message(csound, "####### cxx_compile: module_handle:      %p\n", module_handle);
+    }
+    return module_handle;
+}
+
+/**
+ * The header that is precompiled for `-+cxx_pch` if no other header is 
+ * given: the headers that nearly every module includes. They are found 
+ * through the include directories in the compiler command.
+ */
+static const char *default_precompiled_header = 
+    "#include <csdl.h>\n"
+    "#include <cxx_invokable.hpp>\n"
+    "#include <algorithm>\n"
+    "#include <atomic>\n"
+    "#include <cmath>\n"
+    "#include <cstdio>\n"
+    "#include <cstring>\n"
+    "#include <iostream>\n"
+    "#include <memory>\n"
+    "#include <sstream>\n"
+    "#include <string>\n"
+    "#include <vector>\n";
+
+/**
+ * Serializes the creation of precompiled headers, so that modules compiled 
+ * at the same time with the same command create the header only once.
+ */
+static std::mutex &precompiled_header_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+/**
+ * Returns the compiler command with an option to include a precompiled 
+ * header, which is first created if need be. The header is precompiled with 
+ * the same compiler command as the module, so the compiler always accepts 
+ * it. The header includes either `header_filepath`, or if that is empty, 
+ * `default_precompiled_header`. Precompiled headers are kept in the module 
+ * cache (or otherwise in the temporary directory), with names derived from 
+ * the compiler command, the compiler version, the Csound ABI, the contents 
+ * of the interface headers (see `interface_headers_hash`), and the header 
+ * to be precompiled and its modification time. Both gcc and clang use the 
+ * precompiled header (`.gch` or `.pch`) automatically when its header is 
+ * `-include`d. If the header cannot be precompiled, the command is returned 
+ * unchanged.
+ */
+static std::string with_precompiled_header(CSOUND *csound, const std::string &compiler_command, const std::string &header_filepath) {
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    if (tokens.empty()) {
+        return compiler_command;
+    }
+    const auto &compiler = tokens.front();
+    std::string header_source = default_precompiled_header;
+    std::error_code error_code;
+    if (header_filepath.empty() == false) {
+        auto absolute_filepath = std::filesystem::absolute(header_filepath, error_code).string();
+        header_source = "#include \"" + absolute_filepath + "\"\n";
+        auto modified = std::filesystem::last_write_time(absolute_filepath, error_code);
+        header_source += "// " + std::to_string(modified.time_since_epoch().count()) + "\n";
+    }
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(module_cache_mutex());
+        directory = module_cache().enabled() ? module_cache().directory : std::filesystem::temp_directory_path().string();
+    }
+    auto version = compiler_version(compiler);
+    bool is_clang = version.find("clang") != std::string::npos;
+    auto hash = fnv1a(header_source, fnv1a(compiler_command, fnv1a(version, fnv1a(csound_abi()))));
+    // The compiler does not check whether the headers that a precompiled 
+    // header was built from have changed.
+    hash = fnv1a(std::to_string(interface_headers_hash(compiler_command)), hash);
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash);
+    auto header = directory + "/cxx_pch_" + key + ".hpp";
+    auto precompiled_header = header + (is_clang ? ".pch" : ".gch");
+    std::lock_guard<std::mutex> lock(precompiled_header_mutex());
+    if (std::filesystem::exists(precompiled_header, error_code) == false) {
+        std::filesystem::create_directories(directory, error_code);
+        auto file_ = std::fopen(header.c_str(), "w");
+        if (file_ == nullptr) {
+            csound->Message(csound, "cxx_compile: could not write %s; not using a precompiled header.\n", header.c_str());
+            return compiler_command;
+        }
+        std::fwrite(header_source.data(), 1, header_source.size(), file_);
+        std::fclose(file_);
+        // Precompile to a temporary name and rename, so that other 
+        // processes never use a partially written precompiled header.
+        auto temporary = precompiled_header + "." + process_nonce() + ".tmp";
+        auto command = compiler_command + " -c -x c++-header " + header + " -o" + temporary;
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+            csound->Message(csound, "####### cxx_compile: precompiling:       %s\n", command.c_str());
+        }
+        auto result = std::system(command.c_str());
+        if (result == 0) {
+            std::filesystem::rename(temporary, precompiled_header, error_code);
+        }
+        if (result != 0 || error_code) {
+            std::filesystem::remove(temporary, error_code);
+            csound->Message(csound, "cxx_compile: could not precompile %s (%d); not using a precompiled header.\n", header.c_str(), result);
+            return compiler_command;
+        }
+    } else if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_compile: precompiled header: %s\n", precompiled_header.c_str());
+    }
+    return compiler_command + " -include " + header;
+}
+
+/**
+ * Serializes the profile-guided builds of one module, which compile in the 
+ * module's profile directory with fixed file names: between the threads of 
+ * this process with a mutex for the directory, and between processes that 
+ * share the directory with a lock on a file in it. Builds of other modules 
+ * proceed concurrently. The lock is held until it is destroyed.
+ */
+class ProfileDirectoryLock {
+public:
+    ~ProfileDirectoryLock() {
+        release();
+    }
+    /**
+     * Blocks until this holds the lock for the directory. Returns false if 
+     * the lock file could not be locked, in which case only builds in this 
+     * process are excluded.
+     */
+    bool acquire(const std::string &directory) {
+        release();
+        std::mutex *directory_mutex;
+        {
+            static std::mutex mutexes_mutex;
+            static std::map<std::string, std::unique_ptr<std::mutex>> mutexes;
+            std::lock_guard<std::mutex> lock(mutexes_mutex);
+            auto &mutex_ = mutexes[directory];
+            if (!mutex_) {
+                mutex_.reset(new std::mutex);
+            }
+            directory_mutex = mutex_.get();
+        }
+        thread_lock = std::unique_lock<std::mutex>(*directory_mutex);
+        auto filepath = directory + "/cxx_pgo.lock";
+#if defined(WIN32)
+        file = CreateFileA(filepath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        OVERLAPPED overlapped{};
+        if (LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) == FALSE) {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+            return false;
+        }
+#else
+        file = open(filepath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (file == -1) {
+            return false;
+        }
+        int result;
+        do {
+            result = flock(file, LOCK_EX);
+        } while (result == -1 && errno == EINTR);
+        if (result == -1) {
+            close(file);
+            file = -1;
+            return false;
+        }
+#endif
+        return true;
+    }
+    void release() {
+#if defined(WIN32)
+        if (file != INVALID_HANDLE_VALUE) {
+            OVERLAPPED overlapped{};
+            UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &overlapped);
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (file != -1) {
+            // Closing the file releases the lock.
+            close(file);
+            file = -1;
+        }
+#endif
+        if (thread_lock.owns_lock()) {
+            thread_lock.unlock();
+        }
+    }
+private:
+    std::unique_lock<std::mutex> thread_lock;
+#if defined(WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int file = -1;
+#endif
+};
+
+/**
+ * Returns the compiler command with options for profile-guided optimization 
+ * (`-+cxx_pgo`), and the directory for the module's profile data in 
+ * `profile_directory`. The directory is in the module cache (or the 
+ * temporary directory), keyed like the cache, and is locked with 
+ * `profile_lock` for the rest of the build. If there is no profile data in 
+ * the directory yet, the module is instrumented, and writes its profile data 
+ * there when it is unloaded: when the Csound instance is destroyed, or when 
+ * the last instance of a module replaced by `cxx_recompile` has ended. 
+ * Once there is profile data, the module is optimized with it. For gcc, the 
+ * data are `.gcda` files, which gcc names after the source and module 
+ * files, so the module must be compiled in the profile directory (see 
+ * `compile_module`); for clang, the `.profraw` files are first merged with 
+ * `llvm-profdata`. Removing the directory starts the profiling over.
+ */
+static std::string with_profile_guided_optimization(CSOUND *csound, const std::string &entry_point, const std::string &source_code, const std::string &compiler_command, std::string &profile_directory, ProfileDirectoryLock &profile_lock) {
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    if (tokens.empty()) {
+        return compiler_command;
+    }
+    const auto &compiler = tokens.front();
+    bool is_clang = compiler_version(compiler).find("clang") != std::string::npos;
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(module_cache_mutex());
+        directory = module_cache().enabled() ? module_cache().directory : std::filesystem::temp_directory_path().string();
+    }
+    profile_directory = directory + "/cxx_pgo_" + module_cache_key(source_code, compiler_command, entry_point);
+    std::error_code error_code;
+    std::filesystem::create_directories(profile_directory, error_code);
+    if (profile_lock.acquire(profile_directory) == false && log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_WARNING)) {
+        csound->Message(csound, "cxx_compile: could not lock %s; builds of \"%s\" by other processes may collide.\n", profile_directory.c_str(), entry_point.c_str());
+    }
+    bool has_gcc_profile = false;
+    bool has_clang_raw_profile = false;
+    for (const auto &entry : std::filesystem::directory_iterator(profile_directory, error_code)) {
+        auto extension = entry.path().extension();
+        has_gcc_profile = has_gcc_profile || extension == ".gcda";
+        has_clang_raw_profile = has_clang_raw_profile || extension == ".profraw";
+    }
+    if (is_clang) {
+        auto profile = profile_directory + "/default.profdata";
+        bool has_profile = std::filesystem::exists(profile, error_code);
+        if (has_profile == false && has_clang_raw_profile) {
+            // Use the llvm-profdata of the same version as clang, if the 
+            // compiler name has a version suffix (e.g. clang++-15).
+            std::string tool = "llvm-profdata";
+            auto name = std::filesystem::path(compiler).filename().string();
+            auto dash = name.rfind('-');
+            if (dash != std::string::npos && dash + 1 < name.size() && std::isdigit((unsigned char) name[dash + 1])) {
+                tool += name.substr(dash);
+            }
+#if defined(__APPLE__)
+            tool = "xcrun " + tool;
+#endif
+            auto command = tool + " merge -o " + profile + " " + profile_directory + "/*.profraw";
+            if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+                csound->Message(csound, "####### cxx_compile: merge profile:      %s\n", command.c_str());
+            }
+            auto result = std::system(command.c_str());
+            has_profile = result == 0;
+            if (has_profile == false && log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_WARNING)) {
+                csound->Message(csound, "cxx_compile: could not merge the profile data in %s (%d); instrumenting again.\n", profile_directory.c_str(), result);
+            }
+        }
+        if (has_profile) {
+            if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+                csound->Message(csound, "cxx_compile: optimizing \"%s\" with profile %s\n", entry_point.c_str(), profile.c_str());
+            }
+            return compiler_command + " -fprofile-use=" + profile + " -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date";
+        }
+    } else if (has_gcc_profile) {
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+            csound->Message(csound, "cxx_compile: optimizing \"%s\" with profile %s\n", entry_point.c_str(), profile_directory.c_str());
+        }
+        // Counts from instances on several threads may be inconsistent.
+        return compiler_command + " -fprofile-use=" + profile_directory + " -fprofile-correction -Wno-missing-profile";
+    }
+    if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+        csound->Message(csound, "cxx_compile: instrumenting \"%s\" for profile %s\n", entry_point.c_str(), profile_directory.c_str());
+    }
+    return compiler_command + " -fprofile-generate=" + profile_directory;
+}
+
+/**
+ * The instruction set variants for `-+cxx_isa`, from the most to the least 
+ * capable, each with the option that selects it.
+ */
+struct IsaVariant {
+    const char *name;
+    const char *option;
+};
+
+static const std::vector<IsaVariant> &isa_variants() {
+    static const std::vector<IsaVariant> variants = {
+#if defined(__x86_64__) || defined(_M_X64)
+        {"x86-64-v4", "-march=x86-64-v4"},
+        {"x86-64-v3", "-march=x86-64-v3"},
+        {"x86-64-v2", "-march=x86-64-v2"},
+        {"x86-64", "-march=x86-64"},
+#elif defined(__aarch64__) || defined(_M_ARM64)
+        {"armv8.2-a", "-march=armv8.2-a+fp16+dotprod"},
+        {"armv8.1-a", "-march=armv8.1-a"},
+        {"armv8-a", "-march=armv8-a"},
+#endif
+    };
+    return variants;
+}
+
+/**
+ * Returns whether this CPU can run code built for the named variant.
+ */
+static bool cpu_supports_isa_variant(const std::string &name) {
+#if (defined(__x86_64__)) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    bool v2 = __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("sse4.2");
+    bool v3 = v2 && __builtin_cpu_supports("avx") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma");
+    bool v4 = v3 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+    if (name == "x86-64-v4") {
+        return v4;
+    }
+    if (name == "x86-64-v3") {
+        return v3;
+    }
+    if (name == "x86-64-v2") {
+        return v2;
+    }
+    return name == "x86-64";
+#elif defined(__aarch64__) && defined(__APPLE__)
+    // Every Apple CPU implements at least ARMv8.4-A.
+    return name == "armv8.2-a" || name == "armv8.1-a" || name == "armv8-a";
+#elif defined(__aarch64__) && defined(__linux__)
+    auto hwcap = getauxval(AT_HWCAP);
+    bool v8_1 = (hwcap & HWCAP_ATOMICS) != 0;
+    bool v8_2 = v8_1 && (hwcap & HWCAP_FPHP) != 0 && (hwcap & HWCAP_ASIMDHP) != 0 && (hwcap & HWCAP_ASIMDDP) != 0;
+    if (name == "armv8.2-a") {
+        return v8_2;
+    }
+    if (name == "armv8.1-a") {
+        return v8_1;
+    }
+    return name == "armv8-a";
+#else
+    return false;
+#endif
+}
+
+/**
+ * Returns whether the compiler accepts an option, such as an `-march` value 
+ * that older compilers do not know, by checking an empty file with it. This 
+ * is done once per compiler and option per process.
+ */
+static bool compiler_accepts_option(const std::string &compiler, const std::string &option) {
+    static std::mutex mutex_;
+    static std::map<std::string, bool> results;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto command = compiler + " " + option;
+    auto it = results.find(command);
+    if (it != results.end()) {
+        return it->second;
+    }
+#if defined(WIN32)
+    auto probe = command + " -x c++ -fsyntax-only NUL > NUL 2>&1";
+#else
+    auto probe = command + " -x c++ -fsyntax-only /dev/null > /dev/null 2>&1";
+#endif
+    bool accepted = std::system(probe.c_str()) == 0;
+    results[command] = accepted;
+    return accepted;
+}
+
+/**
+ * Returns the compiler command for the most capable instruction set variant 
+ * (`-+cxx_isa`) that this CPU supports and the compiler accepts, of those 
+ * named in the comma-separated `allowed_variants`, or of all variants if 
+ * that is empty. Any `-march` or `-mcpu` options in the command are replaced. The variant 
+ * is part of the command, and so of the module's cache key, so every 
+ * variant of a module is cached separately, and a cache shared by different 
+ * machines holds a variant for each of them. If no variant applies, the 
+ * command is returned unchanged.
+ */
+static std::string with_isa_variant(CSOUND *csound, const std::string &entry_point, const std::string &compiler_command, const std::string &allowed_variants) {
+    std::vector<std::string> allowed;
+    tokenize(allowed_variants, ',', allowed);
+    std::vector<std::string> tokens;
+    tokenize(compiler_command, ' ', tokens);
+    if (tokens.empty()) {
+        return compiler_command;
+    }
+    for (const auto &variant : isa_variants()) {
+        if (allowed.empty() == false && std::find(allowed.begin(), allowed.end(), variant.name) == allowed.end()) {
+            continue;
+        }
+        if (cpu_supports_isa_variant(variant.name) == false) {
+            continue;
+        }
+        // E.g. gcc before 11 and clang before 12 do not know x86-64-v3.
+        if (compiler_accepts_option(tokens.front(), variant.option) == false) {
+            if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+                csound->Message(csound, "cxx_compile: %s does not accept %s; trying the next variant of \"%s\".\n", tokens.front().c_str(), variant.option, entry_point.c_str());
+            }
+            continue;
+        }
+        std::string result;
+        for (const auto &token : tokens) {
+            if (token.rfind("-march=", 0) == 0 || token.rfind("-mcpu=", 0) == 0) {
+                continue;
+            }
+            result += token + " ";
+        }
+        result += variant.option;
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+            csound->Message(csound, "cxx_compile: using the %s variant of \"%s\"\n", variant.name, entry_point.c_str());
+        }
+        return result;
+    }
+    if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_WARNING)) {
+        csound->Message(csound, "cxx_compile: no instruction set variant of \"%s\" in \"%s\" is supported here; using the compiler command as given.\n", entry_point.c_str(), allowed_variants.c_str());
+    }
+    return compiler_command;
+}
+
+/**
+ * Returns whether the module file has already been loaded in the process, 
+ * e.g. by another Csound instance.
+ */
+static bool is_module_loaded(const std::string &module_filepath) {
+#if defined(WIN32)
+    return GetModuleHandleA(module_filepath.c_str()) != nullptr;
+#else
+    void *module_handle = dlopen(module_filepath.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+    if (module_handle == nullptr) {
+        return false;
+    }
+    dlclose(module_handle);
+    return true;
+#endif
+}
+
+/**
+ * Returns a hash of source code that ignores white space and backslashes, 
+ * so that it does not depend on how escapes in a `{{...}}` string were 
+ * processed.
+ */
+static uint64_t source_fingerprint(const char *source_code) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto c = (const unsigned char *) source_code; *c != 0; ++c) {
+        if (std::isspace(*c) || *c == '\\') {
+            continue;
+        }
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * A module in a library built by `cxx_opcodes_bundle` (see 
+ * `CxxBundleEntry`).
+ */
+struct BundledModule {
+    std::string library;
+    std::string entry_point;
+    uint64_t source_fingerprint;
+};
+
+/**
+ * Returns the modules in the bundles listed in `CXX_OPCODES_BUNDLE`, which 
+ * are loaded the first time that this is called, and stay loaded for the 
+ * life of the process, so that loading a module from a bundle again only 
+ * increments the bundle's reference count.
+ */
+static const std::vector<BundledModule> &bundled_modules(CSOUND *csound) {
+    static std::mutex mutex_;
+    static std::vector<BundledModule> modules;
+    static bool loaded = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (loaded) {
+        return modules;
+    }
+    loaded = true;
+    auto bundles = std::getenv("CXX_OPCODES_BUNDLE");
+    if (bundles == nullptr) {
+        return modules;
+    }
+    std::vector<std::string> libraries;
+#if defined(WIN32)
+    tokenize(bundles, ';', libraries);
+#else
+    tokenize(bundles, ':', libraries);
+#endif
+    for (const auto &library : libraries) {
+        if (library.empty()) {
+            continue;
+        }
+        auto handle = cxx_load_library(library.c_str());
+        auto bundle_entries = handle == nullptr ? nullptr : (cxx_bundle_entries_t) csound->GetLibrarySymbol(handle, "cxx_bundle_entries");
+        if (bundle_entries == nullptr) {
+            csound->Message(csound, "cxx_compile: \"%s\" in CXX_OPCODES_BUNDLE is not a bundle.\n", library.c_str());
+            if (handle != nullptr) {
+                unload_module_handle(handle);
+            }
+            continue;
+        }
+        auto interface_version = (cxx_bundle_interface_version_t) csound->GetLibrarySymbol(handle, "cxx_bundle_interface_version");
+        if (interface_version == nullptr || interface_version() != CXX_INVOKABLE_INTERFACE_VERSION) {
+            csound->Message(csound, "cxx_compile: the bundle \"%s\" in CXX_OPCODES_BUNDLE was built for another version of cxx_invokable.hpp; not using it.\n", library.c_str());
+            unload_module_handle(handle);
+            continue;
+        }
+        for (auto entry = bundle_entries(); entry != nullptr && entry->entry_point != nullptr; ++entry) {
+            modules.push_back({library, entry->entry_point, source_fingerprint(entry->source_code)});
+            if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+                csound->Message(csound, "####### cxx_compile: bundled module:     %s in %s\n", entry->entry_point, library.c_str());
+            }
+        }
+    }
+    return modules;
+}
+
+/**
+ * Returns the bundle that contains a module with the entry point and the 
+ * source code, or an empty string.
+ */
+static std::string find_bundled_module(CSOUND *csound, const std::string &entry_point, const std::string &source_code) {
+    const auto &modules = bundled_modules(csound);
+    if (modules.empty()) {
+        return std::string();
+    }
+    auto fingerprint = source_fingerprint(source_code.c_str());
+    bool found_entry_point = false;
+    for (const auto &module : modules) {
+        if (module.entry_point == entry_point) {
+            if (module.source_fingerprint == fingerprint) {
+                return module.library;
+            }
+            found_entry_point = true;
+        }
+    }
+    if (found_entry_point && log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_WARNING)) {
+        csound->Message(csound, "cxx_compile: the bundled module \"%s\" has other source code, compiling it.\n", entry_point.c_str());
+    }
+    return std::string();
+}
+
+/**
+ * Returns the pathname of this Csound instance's copy of the bundle. The 
+ * bundle itself stays loaded for the life of the process (see 
+ * `bundled_modules`), so the dynamic loader would return it, with its static 
+ * data, to every instance; as for modules in the cache, each instance 
+ * instead loads a private copy, which the modules of the bundle share within 
+ * the instance. Returns the bundle itself, with a warning, if it could not 
+ * be copied.
+ */
+static std::string private_bundle(CSOUND *csound, const std::string &bundle) {
+    auto &state = opcodes_state(csound);
+    std::lock_guard<std::mutex> lock(state.bundle_copies_mutex);
+    auto it = state.bundle_copies.find(bundle);
+    if (it != state.bundle_copies.end()) {
+        return it->second;
+    }
+    auto copy_filepath = temporary_filepath(std::filesystem::path(bundle).extension().string().c_str());
+    std::error_code error_code;
+    if (copy_filepath.empty() || std::filesystem::copy_file(bundle, copy_filepath, std::filesystem::copy_options::overwrite_existing, error_code) == false) {
+        if (copy_filepath.empty() == false) {
+            std::filesystem::remove(copy_filepath, error_code);
+        }
+        if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_WARNING)) {
+            csound->Message(csound, "cxx_compile: could not copy the bundle %s; its modules share their static data with other Csound instances.\n", bundle.c_str());
+        }
+        return bundle;
+    }
+    if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_compile: bundle copy:        %s\n", copy_filepath.c_str());
+    }
+    state.bundle_copies[bundle] = copy_filepath;
+    return copy_filepath;
+}
+
+/**
+ * Compiles and loads a module, returning 0 on success with its handles in 
+ * `built_module`; on failure, nothing is left loaded. If the compiler 
+ * command contains the `-+cxx_jit` option, and these opcodes were built 
+ * with the in-process backend, the module is compiled and linked in memory; 
+ * otherwise the external compiler is run and the module is loaded by the 
+ * dynamic loader. May be called from any thread.
+ */
+static int build_private_module(CSOUND *csound, const std::string &entry_point, const std::string &source_code, const std::string &compiler_command_, const std::string &dynamic_link_libraries, BuiltModule &built_module) {
+    void *&module_handle = built_module.handle;
+    module_handle = nullptr;
+    auto compiler_command = compiler_command_;
+    bool use_jit = strip_option(compiler_command, "-+cxx_jit");
+    std::string precompiled_header;
+    bool use_precompiled_header = strip_option(compiler_command, "-+cxx_pch", &precompiled_header);
+    bool use_stdin = strip_option(compiler_command, "-+cxx_stdin");
+    bool use_profile = strip_option(compiler_command, "-+cxx_pgo");
+    std::string allowed_isa_variants;
+    bool use_isa_variant = strip_option(compiler_command, "-+cxx_isa", &allowed_isa_variants);
+    bool use_rt_check = strip_option(compiler_command, "-+cxx_rtcheck");
+    if (use_rt_check) {
+        compiler_command += " -DCXX_RT_CHECK";
+    }
+    // Does not change the module; see `LoadedModule::time_kontrol`.
+    strip_option(compiler_command, "-+cxx_stats");
+    // A module from a bundle is used as it is; specialized versions are 
+    // still compiled.
+    if (compiler_command.find("-DCXX_SPECIALIZED") == std::string::npos) {
+        auto bundle = find_bundled_module(csound, entry_point, source_code);
+        if (bundle.empty() == false) {
+            auto start = monotonic_nanoseconds();
+            module_handle = load_module(csound, private_bundle(csound, bundle), dynamic_link_libraries, built_module.dependency_handles);
+            built_module.load_seconds = seconds_since(start);
+            if (module_handle != nullptr) {
+                if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+                    csound->Message(csound, "cxx_compile: using \"%s\" from the bundle %s.\n", entry_point.c_str(), bundle.c_str());
+                }
+                return OK;
+            }
+            unload_module(nullptr, built_module.dependency_handles);
+        }
+    }
+    if (use_jit) {
+#if defined(CXX_OPCODES_JIT)
+        // Dependencies must be loaded first, so that the JIT can resolve 
+        // symbols in them.
+        load_module(csound, "", dynamic_link_libraries, built_module.dependency_handles);
+        std::string diagnostics;
+        auto start = monotonic_nanoseconds();
+        module_handle = cxx_jit_compile(source_code, compiler_command, diagnostics);
+        built_module.compile_seconds = seconds_since(start);
+        if (diagnostics.empty() == false) {
+            csound->Message(csound, "%s", diagnostics.c_str());
+        }
+        if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+            csound->Message(csound, "####### cxx_compile: jit module_handle:  %p\n", module_handle);
+        }
+        if (module_handle == nullptr) {
+            unload_module(nullptr, built_module.dependency_handles);
+            return NOTOK;
+        }
+        return OK;
+#else
+        csound->Message(csound, "cxx_compile: -+cxx_jit requires building with CXX_OPCODES_USE_JIT; using the external compiler.\n");
+#endif
+    }
+#if defined(__linux__)
+    if (use_rt_check) {
+        // Calls from the module to these functions go through the wrappers 
+        // in `cxx_invokable.hpp`; fortified variants of printf and the like 
+        // would bypass them.
+        compiler_command += " -DCXX_RT_CHECK_WRAP -U_FORTIFY_SOURCE -Wl";
+        for (auto name = cxx_rt_checked_functions; *name != nullptr; ++name) {
+            compiler_command += ",--wrap=";
+            compiler_command += *name;
+        }
+    }
+#endif
+    if (use_isa_variant) {
+        compiler_command = with_isa_variant(csound, entry_point, compiler_command, allowed_isa_variants);
+    }
+    std::string profile_directory;
+    ProfileDirectoryLock profile_lock;
+    if (use_profile) {
+        compiler_command = with_profile_guided_optimization(csound, entry_point, source_code, compiler_command, profile_directory, profile_lock);
+    }
+    if (use_precompiled_header) {
+        compiler_command = with_precompiled_header(csound, compiler_command, precompiled_header);
+    }
+    std::string module_filepath;
+    bool module_is_temporary;
+    auto start = monotonic_nanoseconds();
+    auto result = compile_module(csound, entry_point, source_code, compiler_command, use_stdin, module_filepath, module_is_temporary, profile_directory);
+    built_module.compile_seconds = seconds_since(start);
+    if (result == 0 && module_is_temporary == false && is_module_loaded(module_filepath)) {
+        // The dynamic loader would return the module that is already loaded 
+        // from the cache, with its static data, so a private copy is loaded.
+        auto copy_filepath = temporary_filepath(".so");
+        std::error_code error_code;
+        if (copy_filepath.empty() == false && std::filesystem::copy_file(module_filepath, copy_filepath, std::filesystem::copy_options::overwrite_existing, error_code)) {
+            module_filepath = copy_filepath;
+            module_is_temporary = true;
+        } else if (copy_filepath.empty() == false) {
+            std::filesystem::remove(copy_filepath, error_code);
+        }
+    }
+    if (result == 0) {
+        start = monotonic_nanoseconds();
+        module_handle = load_module(csound, module_filepath, dynamic_link_libraries, built_module.dependency_handles);
+        built_module.load_seconds = seconds_since(start);
+#if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION)) 
+        // A loaded module stays mapped after its file has been removed.
+        if (module_is_temporary) {
+            std::error_code error_code;
+            std::filesystem::remove(module_filepath, error_code);
+        }
+#endif
+    }
+    if (module_handle == nullptr) {
+        unload_module(nullptr, built_module.dependency_handles);
+    }
+    return result;
+}
+
+/**
+ * As `build_private_module`, but if the compiler command contains the 
+ * `-+cxx_share` option, and another Csound instance in the process has 
+ * already built the same module with that option, uses that instance's 
+ * module instead of building another one. The module is unloaded when the 
+ * last instance that uses it is destroyed.
+ */
+static int build_module(CSOUND *csound, const std::string &entry_point, const std::string &source_code, const std::string &compiler_command_, const std::string &dynamic_link_libraries, BuiltModule &built_module) {
+    built_module.source_code = source_code;
+    built_module.compiler_command = compiler_command_;
+    built_module.dynamic_link_libraries = dynamic_link_libraries;
+    auto compiler_command = compiler_command_;
+    take_log_levels(compiler_command, built_module.log_levels);
+    LogScope log_scope(built_module.log_levels);
+    if (strip_option(compiler_command, "-+cxx_share") == false) {
+        return build_private_module(csound, entry_point, source_code, compiler_command, dynamic_link_libraries, built_module);
+    }
+    uint64_t hash = fnv1a(source_code);
+    hash = fnv1a(compiler_command, hash);
+    hash = fnv1a(entry_point, hash);
+    hash = fnv1a(dynamic_link_libraries, hash);
+    auto key = std::to_string(hash);
+    {
+        std::lock_guard<std::mutex> lock(shared_modules_mutex());
+        auto it = shared_modules().find(key);
+        if (it != shared_modules().end()) {
+            it->second.references++;
+            built_module.handle = it->second.handle;
+            built_module.shared = true;
+            if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+                csound->Message(csound, "####### cxx_compile: shared module_handle: %p references: %ld\n", built_module.handle, it->second.references);
+            }
+            return OK;
+        }
+    }
+    auto result = build_private_module(csound, entry_point, source_code, compiler_command, dynamic_link_libraries, built_module);
+    if (built_module.handle == nullptr) {
+        return result;
+    }
+    void *redundant_handle = nullptr;
+    std::vector<void *> redundant_dependency_handles;
+    {
+        std::lock_guard<std::mutex> lock(shared_modules_mutex());
+        auto &shared_module = shared_modules()[key];
+        if (shared_module.handle == nullptr) {
+            shared_module.handle = built_module.handle;
+            shared_module.dependency_handles.swap(built_module.dependency_handles);
+        } else {
+            // Another instance built the same module at the same time.
+            redundant_handle = built_module.handle;
+            redundant_dependency_handles.swap(built_module.dependency_handles);
+            built_module.handle = shared_module.handle;
+        }
+        shared_module.references++;
+        built_module.shared = true;
+    }
+    unload_module(redundant_handle, redundant_dependency_handles);
+    return result;
+}
+
+/**
+ * Makes a loaded module visible to `cxx_invoke`, and then calls its entry 
+ * point. If `replace` is true, the module is a new version of the current 
+ * module with the same entry point, if there is one: its factories replace 
+ * that module's factories for new notes, and that module and its 
+ * specialized versions are retired. If `specialization` is not empty, the 
+ * module is a specialized version (see `CxxSpecialization`): only its 
+ * factory `factory_name` is registered, as `specialization`, and its entry 
+ * point is not called. Must be called from a Csound thread during an init 
+ * pass or a kperiod, because the entry point has full access to Csound.
+ */
+static int publish_module(CSOUND *csound, BuiltModule &built_module, const std::string &entry_point, bool replace = false, const std::string &factory_name = std::string(), const std::string &specialization = std::string()) {
+    void *module_handle = built_module.handle;
+    if (module_handle == nullptr) {
+        return NOTOK;
+    }
+    auto &state = opcodes_state(csound);
+    LogScope log_scope(built_module.log_levels);
+    // The version of `cxx_invokable.hpp` that the module was compiled 
+    // against, which need not be the one these opcodes were built with.
+    auto interface_version_function = (cxx_invokable_interface_version_t) module_symbol(csound, module_handle, "cxx_invokable_interface_version");
+    int interface_version = interface_version_function != nullptr ? interface_version_function() : 0;
+    if (interface_version != 0 && interface_version != CXX_INVOKABLE_INTERFACE_VERSION) {
+        csound->Message(csound, "Error: cxx_compile: the module \"%s\" was compiled against version %d of cxx_invokable.hpp, but these opcodes use version %d; check the include path.\n", entry_point.c_str(), interface_version, CXX_INVOKABLE_INTERFACE_VERSION);
+        unload_module(module_handle, built_module.dependency_handles, built_module.shared);
+        built_module.handle = nullptr;
+        return NOTOK;
+    }
+    // A module shared between Csound instances has the levels of the 
+    // instance that published it last.
+    auto set_module_diagnostics = (cxx_set_module_diagnostics_t) module_symbol(csound, module_handle, "cxx_set_module_diagnostics");
+    if (set_module_diagnostics != nullptr) {
+        set_module_diagnostics(built_module.log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_DEBUG));
+    }
+    LoadedModule *module_ = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(state.registry_mutex);
+        LoadedModule *replaced_module = nullptr;
+        if (replace) {
+            for (auto &module : state.loaded_modules) {
+                if (module->retired == false && module->entry_point == entry_point && module->specialization.empty()) {
+                    replaced_module = module.get();
+                }
+            }
+        }
+        auto module = std::make_unique<LoadedModule>();
+        module->handle = module_handle;
+        module->dependency_handles.swap(built_module.dependency_handles);
+        module->shared = built_module.shared;
+        module->log_levels = built_module.log_levels;
+        module->compile_seconds = built_module.compile_seconds;
+        module->load_seconds = built_module.load_seconds;
+        module->source_code.swap(built_module.source_code);
+        module->compiler_command.swap(built_module.compiler_command);
+        module->dynamic_link_libraries.swap(built_module.dynamic_link_libraries);
+        module->specialization = specialization;
+        module->interface_version = interface_version;
+        module->rt_check = (cxx_rt_check_scope_t) module_symbol(csound, module_handle, "cxx_rt_check_scope");
+        if (module->rt_check != nullptr) {
+            auto compiler_command = module->compiler_command;
+            std::string deadline;
+            if (strip_option(compiler_command, "-+cxx_rtcheck", &deadline) && std::atof(deadline.c_str()) > 0) {
+                module->rt_check_deadline = std::atof(deadline.c_str());
+            }
+        }
+        {
+            auto compiler_command = module->compiler_command;
+            module->time_kontrol = strip_option(compiler_command, "-+cxx_stats") || module->rt_check != nullptr;
+        }
+        built_module.handle = nullptr;
+        module->entry_point = entry_point;
+        if (replaced_module != nullptr) {
+            module->version = replaced_module->version + 1;
+        }
+        module_ = module.get();
+        state.loaded_modules.push_back(std::move(module));
+        if (specialization.empty() == false) {
+            auto factory = (cxx_invokable_factory_t) module_symbol(csound, module_handle, factory_name.c_str());
+            if (factory == nullptr) {
+                csound->Message(csound, "Error: cxx_invoke: factory \"%s\" not found in its specialized module.\n", factory_name.c_str());
+            } else {
+                register_factory(csound, module_, specialization.c_str(), factory, false, factory_name.c_str());
+            }
+        } else {
+            register_module_factories(csound, module_, replaced_module != nullptr);
+        }
+        if (replaced_module != nullptr) {
+            for (auto &module : state.loaded_modules) {
+                if (module->retired == false && module->entry_point == entry_point && module->specialization.empty() == false) {
+                    retire_module(state, module.get());
+                }
+            }
+            retire_module(state, replaced_module);
+            if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_INFO)) {
+                csound->Message(csound, "####### cxx_recompile: entry_point:      %s version: %d\n", entry_point.c_str(), module_->version);
+            }
+        }
+    }
+    start_module_reaper(state);
+    if (specialization.empty() == false) {
+        return OK;
+    }
+    csound_main_t entry_point_symbol = (csound_main_t) module_symbol(csound, module_handle, entry_point.c_str());
+    if (log_enabled(csound, CXX_LOG_LOAD, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### cxx_compile: entry_point:        %s\n", entry_point.c_str());
+        csound->Message(csound, "####### cxx_compile: entry_point_symbol: %p\n", entry_point_symbol);
+    }
+    if (entry_point_symbol == nullptr) {
+        csound->Message(csound, "Error: cxx_compile: entry point \"%s\" not found.\n", entry_point.c_str());
+        return NOTOK;
+    }
+    auto start = monotonic_nanoseconds();
+    auto result = entry_point_symbol(csound);
+    module_->entry_point_seconds = seconds_since(start);
+    {
+        std::lock_guard<std::mutex> lock(state.registry_mutex);
+        for (auto &record : state.factory_records) {
+            if (record->module == module_) {
+                record->entry_point_seconds = module_->entry_point_seconds;
+            }
+        }
+    }
+    return result;
+}
+
+class CxxCompile : public csound::OpcodeBase<CxxCompile>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_result;
+    // INPUTS
+    STRINGDAT *S_entry_point;
+    STRINGDAT *S_source_code;
+    // Compiler name and all compiler options except for source code filename,
+    // output name, and dynamic link libraries.
+    STRINGDAT *S_compiler_command;
+    // All dynamic link libraries required by the compiler command.
+    STRINGDAT *S_dynamic_link_libraries;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        // Parse the compiler options.
+        auto cxx_command = csound->strarg2name(csound, (char *)0, S_compiler_command->data, (char *)"", 1);
+        auto entry_point = csound->strarg2name(csound, (char *)0, S_entry_point->data, (char *)"", 1);
+        auto source_code = csound->strarg2name(csound, (char *)0, S_source_code->data, (char *)"", 1);
+        std::string dynamic_link_libraries;
+        if (S_dynamic_link_libraries != nullptr) {
+            dynamic_link_libraries = csound->strarg2name(csound, (char *)0, S_dynamic_link_libraries->data, (char *)"", 1);
+        }
+        // Compile the source code to a module, and call its
+        // csound_main entry point.
+        BuiltModule built_module;
+        auto result = build_module(csound, entry_point, source_code, cxx_command, dynamic_link_libraries, built_module);
+        if (result == 0) {
+            result = publish_module(csound, built_module, entry_point);
+        }
+        return result;
+    };
+};
+
+/**
+ * The state of one `cxx_compile_async` compilation. The compiler runs, and 
+ * the module is loaded, on a worker thread. The entry point is called, and 
+ * the module is published to `cxx_invoke`, on a Csound thread by whichever 
+ * of `cxx_compile_status`, `cxx_compile_wait`, or `cxx_invoke` first finds 
+ * that the module has been loaded.
+ */
+struct AsyncCompilation {
+    enum {
+        FAILED = -1,
+        COMPILING = 0,
+        READY = 1,
+        LOADED = 2,
+        PUBLISHING = 3,
+    };
+    std::string entry_point;
+    std::string source_code;
+    std::string compiler_command;
+    std::string dynamic_link_libraries;
+    // True for `cxx_recompile`.
+    bool replace = false;
+    // For a specialized version of a module, the factory and the name under 
+    // which it is registered; see `publish_module`.
+    std::string factory_name;
+    std::string specialization;
+    std::atomic<int> status{COMPILING};
+    int result = OK;
+    // The Csound instance that started the compilation.
+    CSOUND *csound = nullptr;
+    BuiltModule module;
+    std::thread thread;
+    std::mutex join_mutex;
+};
+
+static std::mutex &async_compilations_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+/**
+ * Counts, for the whole process, the asynchronous compilations that have 
+ * finished building or publishing their modules (or have failed to), so 
+ * that a note can tell without taking a lock whether a factory that it is 
+ * waiting for may have been published since it last looked.
+ */
+static std::atomic<uint64_t> &async_compilation_events() {
+    static std::atomic<uint64_t> count_{0};
+    return count_;
+}
+
+/**
+ * All asynchronous compilations of all Csound instances in this process, 
+ * by handle, until their Csound instances are destroyed. Handles are never 
+ * reused.
+ */
+static std::map<long, std::unique_ptr<AsyncCompilation>> &async_compilations() {
+    static std::map<long, std::unique_ptr<AsyncCompilation>> async_compilations_;
+    return async_compilations_;
+}
+
+static AsyncCompilation *find_async_compilation(CSOUND *csound, MYFLT handle) {
+    std::lock_guard<std::mutex> lock(async_compilations_mutex());
+    auto it = async_compilations().find(long(handle));
+    if (it == async_compilations().end() || it->second->csound != csound) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+/**
+ * If the module of an asynchronous compilation has been loaded, calls its 
+ * entry point and publishes it. Exactly one caller wins the transition from 
+ * LOADED to PUBLISHING. Returns the status of the compilation.
+ */
+static int publish_async_compilation(CSOUND *csound, AsyncCompilation *compilation) {
+    int expected = AsyncCompilation::LOADED;
+    if (compilation->status.compare_exchange_strong(expected, AsyncCompilation::PUBLISHING)) {
+        compilation->result = publish_module(csound, compilation->module, compilation->entry_point, compilation->replace, compilation->factory_name, compilation->specialization);
+        compilation->status = compilation->result == OK ? AsyncCompilation::READY : AsyncCompilation::FAILED;
+        async_compilation_events().fetch_add(1, std::memory_order_release);
+        return compilation->status;
+    }
+    // Another thread is publishing; to the caller, that is still compiling.
+    if (expected == AsyncCompilation::PUBLISHING) {
+        return AsyncCompilation::COMPILING;
+    }
+    return expected;
+}
+
+/**
+ * Publishes every asynchronous compilation whose module has been loaded. 
+ * Returns the number of compilations that are still in progress.
+ */
+static int publish_async_compilations(CSOUND *csound) {
+    std::vector<AsyncCompilation *> compilations;
+    {
+        std::lock_guard<std::mutex> lock(async_compilations_mutex());
+        for (auto &entry : async_compilations()) {
+            if (entry.second->csound == csound) {
+                compilations.push_back(entry.second.get());
+            }
+        }
+    }
+    int pending = 0;
+    for (auto compilation : compilations) {
+        if (publish_async_compilation(csound, compilation) == AsyncCompilation::COMPILING) {
+            ++pending;
+        }
+    }
+    return pending;
+}
+
+/**
+ * Waits for all asynchronous compilations of a Csound instance to finish, 
+ * so that no worker thread outlives the opcodes; then unloads the modules 
+ * that were loaded but never published, and discards the compilations.
+ */
+static void join_async_compilations(CSOUND *csound) {
+    std::vector<std::unique_ptr<AsyncCompilation>> compilations;
+    {
+        std::lock_guard<std::mutex> lock(async_compilations_mutex());
+        for (auto it = async_compilations().begin(); it != async_compilations().end(); ) {
+            if (it->second->csound == csound) {
+                compilations.push_back(std::move(it->second));
+                it = async_compilations().erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto &compilation : compilations) {
+        {
+            std::lock_guard<std::mutex> join_lock(compilation->join_mutex);
+            if (compilation->thread.joinable()) {
+                compilation->thread.join();
+            }
+        }
+        unload_module(compilation->module.handle, compilation->module.dependency_handles, compilation->module.shared);
+    }
+}
+
+/**
+ * Starts compiling and loading a module on a worker thread, and returns the 
+ * handle of the compilation.
+ */
+static MYFLT start_async_compilation(CSOUND *csound, const char *opcode_name, const std::string &entry_point, const std::string &source_code, const std::string &compiler_command, const std::string &dynamic_link_libraries, bool replace, const std::string &factory_name = std::string(), const std::string &specialization = std::string()) {
+    auto compilation = std::make_unique<AsyncCompilation>();
+    compilation->factory_name = factory_name;
+    compilation->specialization = specialization;
+    compilation->compiler_command = compiler_command;
+    compilation->entry_point = entry_point;
+    compilation->source_code = source_code;
+    compilation->dynamic_link_libraries = dynamic_link_libraries;
+    compilation->replace = replace;
+    compilation->csound = csound;
+    auto compilation_ = compilation.get();
+    static long next_handle = 0;
+    std::lock_guard<std::mutex> lock(async_compilations_mutex());
+    MYFLT handle = next_handle++;
+    async_compilations()[long(handle)] = std::move(compilation);
+    compilation_->thread = std::thread([csound, compilation_] () {
+        compilation_->result = build_module(csound, compilation_->entry_point, compilation_->source_code, compilation_->compiler_command, compilation_->dynamic_link_libraries, compilation_->module);
+        compilation_->status = compilation_->module.handle != nullptr ? AsyncCompilation::LOADED : AsyncCompilation::FAILED;
+        async_compilation_events().fetch_add(1, std::memory_order_release);
+    });
+    if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_DEBUG)) {
+        csound->Message(csound, "####### %s: handle:       %d entry_point: %s\n", opcode_name, (int) handle, compilation_->entry_point.c_str());
+    }
+    return handle;
+}
+
+static MYFLT start_async_compilation(CSOUND *csound, const char *opcode_name, STRINGDAT *S_entry_point, STRINGDAT *S_source_code, const std::string &compiler_command, STRINGDAT *S_dynamic_link_libraries, bool replace) {
+    std::string entry_point = csound->strarg2name(csound, (char *)0, S_entry_point->data, (char *)"", 1);
+    std::string source_code = csound->strarg2name(csound, (char *)0, S_source_code->data, (char *)"", 1);
+    std::string dynamic_link_libraries;
+    if (S_dynamic_link_libraries != nullptr) {
+        dynamic_link_libraries = csound->strarg2name(csound, (char *)0, S_dynamic_link_libraries->data, (char *)"", 1);
+    }
+    return start_async_compilation(csound, opcode_name, entry_point, source_code, compiler_command, dynamic_link_libraries, replace);
+}
+
+/**
+ * Blocks until an asynchronous compilation has finished, publishes the 
+ * module, and returns the result of the compilation.
+ */
+static int wait_for_async_compilation(CSOUND *csound, AsyncCompilation *compilation) {
+    {
+        std::lock_guard<std::mutex> lock(compilation->join_mutex);
+        if (compilation->thread.joinable()) {
+            compilation->thread.join();
+        }
+    }
+    publish_async_compilation(csound, compilation);
+    return compilation->result;
+}
+
+/**
+ * Same as `cxx_compile`, except that the compiler runs on a worker thread and 
+ * the opcode returns at once, with a handle to the compilation. Use 
+ * `cxx_compile_status` or `cxx_compile_wait` to find out when the module is 
+ * ready; until then, `cxx_invoke` will output silence for its factories.
+ */
+class CxxCompileAsync : public csound::OpcodeBase<CxxCompileAsync>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_handle;
+    // INPUTS
+    STRINGDAT *S_entry_point;
+    STRINGDAT *S_source_code;
+    STRINGDAT *S_compiler_command;
+    STRINGDAT *S_dynamic_link_libraries;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        std::string compiler_command = csound->strarg2name(csound, (char *)0, S_compiler_command->data, (char *)"", 1);
+        *i_handle = start_async_compilation(csound, "cxx_compile_async", S_entry_point, S_source_code, compiler_command, S_dynamic_link_libraries, false);
+        return OK;
+    };
+};
+
+/**
+ * Compiles a new version of the module with the given entry point, in the 
+ * same way as `cxx_compile_async`. When the new module has been loaded, its 
+ * factories replace those of the current version for new notes, and its 
+ * entry point is called. Notes already playing finish on the old version, 
+ * which is unloaded, off the performance threads, after its last instance 
+ * has ended. If there is no current version, this is the same as 
+ * `cxx_compile_async`.
+ */
+class CxxRecompile : public csound::OpcodeBase<CxxRecompile>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_handle;
+    // INPUTS
+    STRINGDAT *S_entry_point;
+    STRINGDAT *S_source_code;
+    STRINGDAT *S_compiler_command;
+    STRINGDAT *S_dynamic_link_libraries;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        std::string compiler_command = csound->strarg2name(csound, (char *)0, S_compiler_command->data, (char *)"", 1);
+#if !defined(__APPLE__) && !defined(WIN32)
+        // Every version of the module is loaded in global scope, so without 
+        // this, calls within the new version to its own functions could 
+        // bind to the old version.
+        compiler_command += " -Wl,-Bsymbolic";
+#endif
+        *i_handle = start_async_compilation(csound, "cxx_recompile", S_entry_point, S_source_code, compiler_command, S_dynamic_link_libraries, true);
+        return OK;
+    };
+};
+
+/**
+ * Returns the status of a `cxx_compile_async` compilation at i-time and 
+ * every kperiod: 0 while compiling, 1 when the module is ready, and -1 if 
+ * compilation or loading failed. When the module is first found to have 
+ * been loaded, its entry point is called from this opcode.
+ */
+class CxxCompileStatus : public csound::OpcodeBase<CxxCompileStatus>
+{
+public:
+    // OUTPUTS
+    MYFLT *k_status;
+    // INPUTS
+    MYFLT *i_handle;
+    // STATE
+    AsyncCompilation *compilation;
+    int init(CSOUND *csound)
+    {
+        compilation = find_async_compilation(csound, *i_handle);
+        if (compilation == nullptr) {
+            return csound->InitError(csound, "cxx_compile_status: invalid handle: %g\n", *i_handle);
+        }
+        return kontrol(csound);
+    }
+    int kontrol(CSOUND *csound)
+    {
+        *k_status = publish_async_compilation(csound, compilation);
+        return OK;
+    }
+};
+
+/**
+ * Blocks until a `cxx_compile_async` compilation has finished, publishes the 
+ * module, and returns the same result that `cxx_compile` would have 
+ * returned.
+ */
+class CxxCompileWait : public csound::OpcodeBase<CxxCompileWait>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_result;
+    // INPUTS
+    MYFLT *i_handle;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        auto compilation = find_async_compilation(csound, *i_handle);
+        if (compilation == nullptr) {
+            return csound->InitError(csound, "cxx_compile_wait: invalid handle: %g\n", *i_handle);
+        }
+        *i_result = wait_for_async_compilation(csound, compilation);
+        return OK;
+    };
+};
+
+/**
+ * A module declared by `cxx_compile_declare`, to be compiled in parallel 
+ * with other declared modules by `cxx_compile_all`.
+ */
+struct ModuleDeclaration {
+    std::string entry_point;
+    std::string source_code;
+    std::string compiler_command;
+    std::string dynamic_link_libraries;
+    // The Csound instance that declared the module.
+    CSOUND *csound = nullptr;
+    BuiltModule module;
+    int result = OK;
+};
+
+static std::mutex &module_declarations_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+/**
+ * The declarations of all Csound instances in this process that have not 
+ * yet been compiled.
+ */
+static std::vector<ModuleDeclaration> &module_declarations() {
+    static std::vector<ModuleDeclaration> module_declarations_;
+    return module_declarations_;
+}
+
+/**
+ * Moves the declarations of a Csound instance, in declaration order, to 
+ * `declarations`. The caller must hold the declarations mutex.
+ */
+static void take_module_declarations(CSOUND *csound, std::vector<ModuleDeclaration> &declarations) {
+    auto &all = module_declarations();
+    auto others = std::stable_partition(all.begin(), all.end(), [csound] (const ModuleDeclaration &declaration) {
+        return declaration.csound == csound;
+    });
+    std::move(all.begin(), others, std::back_inserter(declarations));
+    all.erase(all.begin(), others);
+}
+
+/**
+ * Runs `job(0)` through `job(job_count - 1)` on at most `thread_count` 
+ * threads, in the manner of `make -jN`, and returns when all jobs are done.
+ */
+static void run_jobs(size_t job_count, size_t thread_count, const std::function<void(size_t)> &job) {
+    std::atomic<size_t> next_job{0};
+    std::vector<std::thread> threads;
+    thread_count = std::max<size_t>(1, std::min(thread_count, job_count));
+    for (size_t thread_index = 0; thread_index < thread_count; ++thread_index) {
+        threads.emplace_back([&] () {
+            for (size_t job_index = next_job++; job_index < job_count; job_index = next_job++) {
+                job(job_index);
+            }
+        });
+    }
+    for (auto &thread_ : threads) {
+        thread_.join();
+    }
+}
+
+/**
+ * Declares a module to be compiled later by `cxx_compile_all`. Takes the 
+ * same arguments as `cxx_compile`. Nothing is compiled or loaded here.
+ */
+class CxxCompileDeclare : public csound::OpcodeBase<CxxCompileDeclare>
+{
+public:
+    // OUTPUTS
+    // INPUTS
+    STRINGDAT *S_entry_point;
+    STRINGDAT *S_source_code;
+    STRINGDAT *S_compiler_command;
+    STRINGDAT *S_dynamic_link_libraries;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        ModuleDeclaration declaration;
+        declaration.csound = csound;
+        declaration.entry_point = csound->strarg2name(csound, (char *)0, S_entry_point->data, (char *)"", 1);
+        declaration.source_code = csound->strarg2name(csound, (char *)0, S_source_code->data, (char *)"", 1);
+        declaration.compiler_command = csound->strarg2name(csound, (char *)0, S_compiler_command->data, (char *)"", 1);
+        if (S_dynamic_link_libraries != nullptr) {
+            declaration.dynamic_link_libraries = csound->strarg2name(csound, (char *)0, S_dynamic_link_libraries->data, (char *)"", 1);
+        }
+        std::lock_guard<std::mutex> lock(module_declarations_mutex());
+        module_declarations().push_back(declaration);
+        return OK;
+    };
+};
+
+/**
+ * Compiles all modules declared by `cxx_compile_declare` since the last 
+ * call, concurrently on at most `i_jobs` threads (by default, one per 
+ * hardware thread), so that the build takes about as long as the slowest 
+ * module. When all of the modules have been loaded, their entry points are 
+ * called in declaration order. Returns 0 if every module succeeded, or else 
+ * the result for the first module that failed.
+ */
+class CxxCompileAll : public csound::OpcodeBase<CxxCompileAll>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_result;
+    // INPUTS
+    MYFLT *i_jobs;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        std::vector<ModuleDeclaration> declarations;
+        {
+            std::lock_guard<std::mutex> lock(module_declarations_mutex());
+            take_module_declarations(csound, declarations);
+        }
+        size_t jobs = *i_jobs > 0 ? size_t(*i_jobs) : std::thread::hardware_concurrency();
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+            csound->Message(csound, "####### cxx_compile_all: modules: %d jobs: %d\n", (int) declarations.size(), (int) jobs);
+        }
+        run_jobs(declarations.size(), jobs, [&] (size_t index) {
+            auto &declaration = declarations[index];
+            declaration.result = build_module(csound, declaration.entry_point, declaration.source_code, declaration.compiler_command, declaration.dynamic_link_libraries, declaration.module);
+        });
+        int result = OK;
+        for (auto &declaration : declarations) {
+            if (declaration.result == 0) {
+                declaration.result = publish_module(csound, declaration.module, declaration.entry_point);
+            }
+            if (declaration.result != 0) {
+                csound->Message(csound, "Error: cxx_compile_all: module with entry point \"%s\" failed: %d\n", declaration.entry_point.c_str(), declaration.result);
+                if (result == OK) {
+                    result = declaration.result;
+                }
+            }
+        }
+        *i_result = result;
+        return OK;
+    };
+};
+
+/**
+ * A module declared by `cxx_compile_lazy`, which is not compiled until a 
+ * factory that it defines is needed.
+ */
+struct LazyModule {
+    std::string entry_point;
+    std::vector<std::string> factory_names;
+    std::string source_code;
+    std::string compiler_command;
+    std::string dynamic_link_libraries;
+    // The Csound instance that declared the module.
+    CSOUND *csound = nullptr;
+};
+
+static std::mutex &lazy_modules_mutex() {
+    static std::mutex mutex_;
+    return mutex_;
+}
+
+/**
+ * The lazy modules of all Csound instances in this process whose compilation 
+ * has not yet been started.
+ */
+static std::vector<LazyModule> &lazy_modules() {
+    static std::vector<LazyModule> lazy_modules_;
+    return lazy_modules_;
+}
+
+/**
+ * Removes the lazy modules of a Csound instance that define any of the named 
+ * factories (or all of its lazy modules, if `factory_names` is nullptr), in 
+ * declaration order, to `modules`.
+ */
+static void take_lazy_modules(CSOUND *csound, const std::vector<std::string> *factory_names, std::vector<LazyModule> &modules) {
+    std::lock_guard<std::mutex> lock(lazy_modules_mutex());
+    auto &all = lazy_modules();
+    auto others = std::stable_partition(all.begin(), all.end(), [&] (const LazyModule &module) {
+        if (module.csound != csound) {
+            return false;
+        }
+        if (factory_names == nullptr) {
+            return true;
+        }
+        for (const auto &name : *factory_names) {
+            if (std::find(module.factory_names.begin(), module.factory_names.end(), name) != module.factory_names.end()) {
+                return true;
+            }
+        }
+        return false;
+    });
+    std::move(all.begin(), others, std::back_inserter(modules));
+    all.erase(all.begin(), others);
+}
+
+/**
+ * Starts compiling, as `cxx_compile_async` does, every lazy module of a 
+ * Csound instance that defines any of the named factories and has not been 
+ * started yet. Returns the handles of the compilations.
+ */
+static std::vector<MYFLT> start_lazy_compilations(CSOUND *csound, const std::vector<std::string> &factory_names) {
+    std::vector<MYFLT> handles;
+    std::vector<LazyModule> modules;
+    take_lazy_modules(csound, &factory_names, modules);
+    for (const auto &module : modules) {
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+            log_from_performance(csound, "cxx_compile_lazy: compiling \"%s\".\n", module.entry_point.c_str());
+        }
+        handles.push_back(start_async_compilation(csound, "cxx_compile_lazy", module.entry_point, module.source_code, module.compiler_command, module.dynamic_link_libraries, false));
+    }
+    return handles;
+}
+
+/**
+ * Declares a module together with the names of the factories that it 
+ * defines, without compiling it. The module is compiled on a worker thread, 
+ * as by `cxx_compile_async`, when `cxx_invoke` first needs one of its 
+ * factories, or when `cxx_compile_prefetch` asks for one of them; so a 
+ * performance compiles only the modules that it actually uses.
+ */
+class CxxCompileLazy : public csound::OpcodeBase<CxxCompileLazy>
+{
+public:
+    // OUTPUTS
+    // INPUTS
+    STRINGDAT *S_entry_point;
+    // The names of the factories defined by the module, separated by spaces.
+    STRINGDAT *S_factory_names;
+    STRINGDAT *S_source_code;
+    STRINGDAT *S_compiler_command;
+    STRINGDAT *S_dynamic_link_libraries;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        LazyModule module;
+        module.csound = csound;
+        module.entry_point = csound->strarg2name(csound, (char *)0, S_entry_point->data, (char *)"", 1);
+        tokenize(S_factory_names->data, ' ', module.factory_names);
+        module.source_code = csound->strarg2name(csound, (char *)0, S_source_code->data, (char *)"", 1);
+        module.compiler_command = csound->strarg2name(csound, (char *)0, S_compiler_command->data, (char *)"", 1);
+        if (S_dynamic_link_libraries != nullptr) {
+            module.dynamic_link_libraries = csound->strarg2name(csound, (char *)0, S_dynamic_link_libraries->data, (char *)"", 1);
+        }
+        if (module.factory_names.empty()) {
+            return csound->InitError(csound, "cxx_compile_lazy: module \"%s\" declares no factories.\n", module.entry_point.c_str());
+        }
+        std::lock_guard<std::mutex> lock(lazy_modules_mutex());
+        lazy_modules().push_back(module);
+        return OK;
+    };
+};
+
+/**
+ * Starts compiling the lazy modules that define any of the named factories, 
+ * ahead of the first `cxx_invoke` that needs them. If `i_wait` is not 0, 
+ * waits for the modules to be ready. Returns 0, or else the result for the 
+ * first module that failed.
+ */
+class CxxCompilePrefetch : public csound::OpcodeBase<CxxCompilePrefetch>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_result;
+    // INPUTS
+    // The names of the factories, separated by spaces.
+    STRINGDAT *S_factory_names;
+    MYFLT *i_wait;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        std::vector<std::string> factory_names;
+        tokenize(S_factory_names->data, ' ', factory_names);
+        auto handles = start_lazy_compilations(csound, factory_names);
+        int result = OK;
+        if (*i_wait != 0) {
+            for (auto handle : handles) {
+                auto compilation = find_async_compilation(csound, handle);
+                if (compilation == nullptr) {
+                    continue;
+                }
+                auto compilation_result = wait_for_async_compilation(csound, compilation);
+                if (compilation_result != OK && result == OK) {
+                    result = compilation_result;
+                }
+            }
+        }
+        *i_result = result;
+        return OK;
+    };
+};
+
+/**
+ * Configures the module cache used by `cxx_compile`. An empty directory
+ * disables the cache. A size limit of 0 means that the cache is unlimited.
+ * Evicts least recently used modules as needed to honor the new limit.
+ */
+class CxxCache : public csound::OpcodeBase<CxxCache>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_result;
+    // INPUTS
+    STRINGDAT *S_directory;
+    MYFLT *i_size_limit_megabytes;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        std::lock_guard<std::mutex> lock(module_cache_mutex());
+        module_cache().directory = S_directory->data;
+        module_cache().size_limit = uintmax_t(*i_size_limit_megabytes * 1024. * 1024.);
+        *i_result = 0;
+        if (module_cache().enabled() && module_cache().size_limit != 0) {
+            *i_result = evict_module_cache(module_cache().directory, module_cache().size_limit);
+        }
+        if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+            csound->Message(csound, "####### cxx_cache: directory: \"%s\" size limit: %ju evicted: %d\n", module_cache().directory.c_str(), module_cache().size_limit, (int) *i_result);
+        }
+        return OK;
+    };
+};
+
+/**
+ * Evicts least recently used modules from the module cache until it is no
+ * larger than the given size in megabytes; 0 empties the cache. Returns the
+ * number of modules evicted. Modules that are already loaded are not
+ * affected.
+ */
+class CxxCacheEvict : public csound::OpcodeBase<CxxCacheEvict>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_evicted;
+    // INPUTS
+    MYFLT *i_target_megabytes;
+    // STATE
+    /**
+     * This is an i-time only opcode. Everything happens in init.
+     */
+    int init(CSOUND *csound)
+    {
+        std::lock_guard<std::mutex> lock(module_cache_mutex());
+        *i_evicted = 0;
+        if (module_cache().enabled()) {
+            *i_evicted = evict_module_cache(module_cache().directory, uintmax_t(*i_target_megabytes * 1024. * 1024.));
+        }
+        return OK;
+    };
+};
+
+/**
+ * Ensures that a one-dimensional array output has at least `size` 
+ * elements of `member_size` bytes (by default, numbers), allocating it with 
+ * Csound on first use.
+ */
+static void ensure_array(CSOUND *csound, ARRAYDAT *array, int size, size_t member_size = sizeof(MYFLT)) {
+    size_t bytes = size * member_size;
+    array->arrayMemberSize = int(member_size);
+    if (array->data == nullptr || array->allocated < bytes) {
+        if (array->data == nullptr) {
+            array->data = (MYFLT *) csound->Calloc(csound, bytes);
+        } else {
+            array->data = (MYFLT *) csound->ReAlloc(csound, array->data, bytes);
+        }
+        array->allocated = bytes;
+    }
+    if (array->sizes == nullptr) {
+        array->sizes = (int *) csound->Calloc(csound, sizeof(int));
+    }
+    array->dimensions = 1;
+    array->sizes[0] = size;
+}
+
+/**
+ * The specialized version of a factory that a call site chose for the last 
+ * values of its compile-time parameters, so that later notes with the same 
+ * values find it without building its name, and without taking locks while 
+ * it is still being compiled. Kept in opcode memory, which Csound zeroes.
+ */
+struct SpecializationChoice {
+    static constexpr size_t max_parameters = 16;
+    // The generic record whose parameter inputs have been checked, and 
+    // whether they all exist and are i-time.
+    FactoryRecord *checked_record;
+    bool usable_inputs;
+    // The generic record that the choice was made for.
+    FactoryRecord *generic_record;
+    // nullptr while the specialized version is not ready.
+    FactoryRecord *record;
+    MYFLT values[max_parameters];
+    // The value of `async_compilation_events()` when `record` was last 
+    // looked for.
+    uint64_t compilation_events;
+    char name[0x100];
+};
+
+/**
+ * Builds the specialization's name in `choice.name`, for `values`, e.g. 
+ * `delay_factory<DELAY_LENGTH=480>`, with `#<version>` appended for a 
+ * recompiled module. Returns false if the name is too long.
+ */
+static bool format_specialization_name(SpecializationChoice &choice, const FactoryRecord *record, const MYFLT *values) {
+    auto specialization = record->specialization;
+    size_t size = sizeof(choice.name);
+    size_t length = std::snprintf(choice.name, size, "%s<", record->name.c_str());
+    for (size_t index = 0; index < specialization->count && length < size; ++index) {
+        length += std::snprintf(choice.name + length, size - length, "%s%s=%.17g", index > 0 ? "," : "", specialization->parameters[index].macro, double(values[index]));
+    }
+    if (length < size) {
+        length += std::snprintf(choice.name + length, size - length, ">");
+    }
+    if (length < size && record->version > 1) {
+        length += std::snprintf(choice.name + length, size - length, "#%d", record->version);
+    }
+    return length < size;
+}
+
+/**
+ * Returns the record of the specialized version of a factory for the 
+ * current values of its compile-time parameters in `inputs` (see 
+ * `CxxSpecialization`), or nullptr if that version is not ready yet. The 
+ * first time that a set of values is seen, the specialized version is 
+ * started building in the background. The choice is kept in `choice`; 
+ * only when the values change is the name built and looked up again, and 
+ * while the specialized version is not ready, it is only looked for again 
+ * after some asynchronous compilation has made progress.
+ */
+static FactoryRecord *find_specialized_factory_record(CSOUND *csound, FactoryRecord *record, MYFLT **inputs, size_t input_count, SpecializationChoice &choice) {
+    auto specialization = record->specialization;
+    if (specialization->count > SpecializationChoice::max_parameters) {
+        return nullptr;
+    }
+    if (choice.checked_record != record) {
+        // The values become compile-time constants, so they must be numbers 
+        // that are fixed for the note; the types of the inputs are the same 
+        // for every note of this opcode.
+        choice.checked_record = record;
+        choice.usable_inputs = true;
+        for (size_t index = 0; index < specialization->count && choice.usable_inputs; ++index) {
+            const auto &parameter = specialization->parameters[index];
+            const CS_TYPE *type = nullptr;
+            if (parameter.input >= 0 && size_t(parameter.input) < input_count) {
+                type = csound->GetTypeForArg(inputs[parameter.input]);
+            }
+            if (type == nullptr || (std::strcmp(type->varTypeName, "i") != 0 && std::strcmp(type->varTypeName, "c") != 0)) {
+                choice.usable_inputs = false;
+                if (log_enabled(csound, CXX_LOG_INVOKE, CXX_LOG_WARNING)) {
+                    log_from_performance(csound, "cxx_invoke: factory \"%s\": input %d for %s is not an i-time number; using the generic version.\n", record->name.c_str(), parameter.input, parameter.macro);
+                }
+            }
+        }
+    }
+    if (choice.usable_inputs == false) {
+        return nullptr;
+    }
+    MYFLT values[SpecializationChoice::max_parameters];
+    bool same_values = choice.generic_record == record;
+    for (size_t index = 0; index < specialization->count; ++index) {
+        const auto &parameter = specialization->parameters[index];
+        values[index] = *inputs[parameter.input];
+        same_values = same_values && values[index] == choice.values[index];
+    }
+    auto &state = opcodes_state(csound);
+    if (same_values) {
+        if (choice.record != nullptr && choice.record->superseded.load(std::memory_order_acquire) == false) {
+            return choice.record;
+        }
+        auto compilation_events = async_compilation_events().load(std::memory_order_acquire);
+        if (choice.record == nullptr && compilation_events == choice.compilation_events) {
+            return nullptr;
+        }
+        choice.compilation_events = compilation_events;
+        choice.record = lookup_factory_record(state, choice.name);
+        if (choice.record == nullptr) {
+            publish_async_compilations(csound);
+            choice.record = lookup_factory_record(state, choice.name);
+        }
+        return choice.record;
+    }
+    choice.generic_record = nullptr;
+    if (format_specialization_name(choice, record, values) == false) {
+        return nullptr;
+    }
+    choice.generic_record = record;
+    std::copy(values, values + specialization->count, choice.values);
+    choice.compilation_events = async_compilation_events().load(std::memory_order_acquire);
+    choice.record = lookup_factory_record(state, choice.name);
+    if (choice.record != nullptr) {
+        return choice.record;
+    }
+    bool requested;
+    {
+        std::lock_guard<std::mutex> lock(state.specializations_mutex);
+        requested = state.specializations.insert(choice.name).second == false;
+    }
+    if (requested) {
+        publish_async_compilations(csound);
+        choice.record = lookup_factory_record(state, choice.name);
+        return choice.record;
+    }
+    if (log_enabled(csound, CXX_LOG_COMPILE, CXX_LOG_INFO)) {
+        log_from_performance(csound, "cxx_invoke: specializing \"%s\" as \"%s\".\n", record->name.c_str(), choice.name);
+    }
+    auto module = record->module;
+    auto compiler_command = module->compiler_command + " -DCXX_SPECIALIZED";
+    for (size_t index = 0; index < specialization->count; ++index) {
+        char define[0x100];
+        std::snprintf(define, sizeof(define), " -D%s=%.17g", specialization->parameters[index].macro, double(values[index]));
+        compiler_command += define;
+    }
+#if !defined(__APPLE__) && !defined(WIN32)
+    // As for `cxx_recompile`: the specialized version is loaded in global 
+    // scope, and its own calls must not bind to the generic version.
+    compiler_command += " -Wl,-Bsymbolic";
+#endif
+    start_async_compilation(csound, "cxx_invoke", module->entry_point, module->source_code, compiler_command, module->dynamic_link_libraries, false, record->name, choice.name);
+    return nullptr;
+}
+
+static constexpr uint64_t rt_check_report_limit = 64;
+
+/**
+ * Counts and logs the real-time violations of one call of a module built 
+ * with `-+cxx_rtcheck`, and whether the call missed its deadline (if 
+ * `deadline` is not 0). Only the first few reports for a factory are 
+ * logged; all are counted (see `cxx_stats`).
+ */
+static void report_rt_check(CSOUND *csound, FactoryRecord *record, const char *call, uint64_t call_number, const CxxRtViolations &violations, uint64_t elapsed, uint64_t deadline) {
+    auto violation_count = violations.allocations + violations.locks + violations.system_calls;
+    bool missed_deadline = deadline > 0 && elapsed > deadline;
+    if (violation_count == 0 && missed_deadline == false) {
+        return;
+    }
+    if (violation_count > 0) {
+        record->rt_violations.fetch_add(violation_count, std::memory_order_relaxed);
+    }
+    if (missed_deadline) {
+        record->deadline_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (log_enabled(csound, CXX_LOG_INVOKE, CXX_LOG_WARNING) == false) {
+        return;
+    }
+    auto reports = record->rt_reports.fetch_add(1, std::memory_order_relaxed);
+    if (reports > rt_check_report_limit) {
+        return;
+    }
+    if (reports == rt_check_report_limit) {
+        log_from_performance(csound, "cxx_invoke: factory \"%s\": further real-time violations are counted, but not logged.\n", record->name.c_str());
+        return;
+    }
+    if (violation_count > 0) {
+        log_from_performance(csound, "cxx_invoke: factory \"%s\" %s call %llu: %llu allocations, %llu locks, %llu system calls.\n", record->name.c_str(), call, (unsigned long long) call_number, (unsigned long long) violations.allocations, (unsigned long long) violations.locks, (unsigned long long) violations.system_calls);
+    }
+    if (missed_deadline) {
+        log_from_performance(csound, "cxx_invoke: factory \"%s\" %s call %llu took %.3f ms, over its deadline of %.3f ms.\n", record->name.c_str(), call, (unsigned long long) call_number, elapsed * 1e-6, deadline * 1e-6);
+    }
+}
+
+/**
+ * The state and the logic of one `cxx_invoke` or `cxx_invoke_array` call 
+ * site: finding the factory, creating the instance, calling it, and 
+ * timing the calls. The opcodes own the arguments, which Csound requires 
+ * to be the first members of an opcode, and pass them as `outputs` and 
+ * `inputs`.
+ */
+struct CxxInvocation {
+    int thread;
+    CxxInvokable *cxx_invokable;
+    // The record found for the factory name, kept for this call site.
+    FactoryRecord *named_record;
+    // The record of the factory that created the live instance: the named 
+    // record, or a specialized version of it.
+    FactoryRecord *factory_record;
+    // The module that is referenced by the live instance.
+    LoadedModule *module;
+    SpecializationChoice specialization_choice;
+    AUXCH invokable_memory;
+    bool invokable_is_placed;
+    // If true, instances are never placed in `invokable_memory`.
+    bool allocate_on_heap;
+    // Chosen at init time for the thread and the factory, so that kontrol 
+    // makes one indirect call through this opcode's own state; nullptr 
+    // outputs silence.
+    int (*kontrol_function)(CxxInvokable *invokable, CSOUND *csound, MYFLT **outputs, MYFLT **inputs);
+    static int kontrol_nothing(CxxInvokable *, CSOUND *, MYFLT **, MYFLT **) {
+        return OK;
+    }
+    static int kontrol_virtual(CxxInvokable *invokable, CSOUND *csound, MYFLT **outputs, MYFLT **inputs) {
+        return invokable->kontrol(csound, outputs, inputs);
+    }
+    // Times of kontrol calls since they were last merged into the factory's 
+    // statistics, if `time_kontrol`.
+    bool time_kontrol;
+    CallTimes kontrol_times;
+    static constexpr uint64_t kontrol_times_merge_interval = 4096;
+    // Non-null if the module was built with `-+cxx_rtcheck`; then each 
+    // `kontrol` call must finish within `deadline_nanoseconds`.
+    cxx_rt_check_scope_t rt_check;
+    uint64_t deadline_nanoseconds;
+    uint64_t kontrol_calls;
+    /**
+     * Returns whether the opcode must output silence, because the factory 
+     * is not ready or the instance has ended.
+     */
+    bool is_silent() const {
+        return kontrol_function == nullptr;
+    }
+    /**
+     * `output_count` and `input_count` are the numbers of `outputs` and 
+     * `inputs` that are passed to the instance. The first `parameter_count` 
+     * inputs are numbers whose i-time values may be compile-time parameters 
+     * of the factory.
+     */
+    int init(CSOUND *csound, OPDS *opds, const char *invokable_factory_name, int thread_, MYFLT **outputs, size_t output_count, MYFLT **inputs, size_t input_count, size_t parameter_count)
+    {
+        if (cxx_invokable != nullptr) {
+            // A tied note runs init again on the same instance without a 
+            // noteoff; end the previous instance, which would otherwise leak 
+            // together with its reference to the module.
+            noteoff(csound);
+        }
+        int result = OK;
+        thread = thread_;
+        cxx_invokable = nullptr;
+        kontrol_function = thread == 1 ? &kontrol_nothing : nullptr;
+        kontrol_times = CallTimes();
+        rt_check = nullptr;
+        time_kontrol = false;
+        kontrol_calls = 0;
+        // The factory record is kept for this call site, even across notes 
+        // when Csound reuses the instrument instance, and is only looked up 
+        // again if the factory name changes or the record is superseded by 
+        // `cxx_recompile`.
+        if (named_record == nullptr || named_record->superseded.load(std::memory_order_acquire) || std::strcmp(named_record->name.c_str(), invokable_factory_name) != 0) {
+            named_record = find_factory_record(csound, invokable_factory_name);
+        }
+        if (named_record == nullptr) {
+            // The factory may be in a module from `cxx_compile_lazy` that 
+            // has not been compiled yet, or in a module from 
+            // `cxx_compile_async` that has been loaded but not yet published; 
+            // if it is still being compiled, output silence until it is 
+            // ready.
+            start_lazy_compilations(csound, {invokable_factory_name});
+            auto pending = publish_async_compilations(csound);
+            named_record = find_factory_record(csound, invokable_factory_name);
+            if (named_record == nullptr) {
+                if (pending > 0) {
+                    if (log_enabled(csound, CXX_LOG_INVOKE, CXX_LOG_INFO)) {
+                        log_from_performance(csound, "cxx_invoke: factory \"%s\" is not ready, outputting silence.\n", invokable_factory_name);
+                    }
+                    kontrol_function = nullptr;
+                    return result;
+                }
+                return csound->InitError(csound, "cxx_invoke: factory \"%s\" was not found in any loaded module.\n", invokable_factory_name);
+            }
+        }
+        // The instance holds a reference to the factory's module, so that the 
+        // module is not unloaded while the instance exists. If the module 
+        // has been retired in the meantime, use the current version.
+        while (acquire_module(named_record->module) == false) {
+            named_record = find_factory_record(csound, invokable_factory_name);
+            if (named_record == nullptr) {
+                return csound->InitError(csound, "cxx_invoke: factory \"%s\" was not found in any loaded module.\n", invokable_factory_name);
+            }
+        }
+        factory_record = named_record;
+        module = factory_record->module;
+        if (factory_record->specialization != nullptr) {
+            auto specialized_record = find_specialized_factory_record(csound, factory_record, inputs, parameter_count, specialization_choice);
+            if (specialized_record != nullptr && acquire_module(specialized_record->module)) {
+                release_module(module);
+                factory_record = specialized_record;
+                module = factory_record->module;
+            }
+        }
+        rt_check = module->rt_check;
+        time_kontrol = module->time_kontrol;
+        if (rt_check != nullptr) {
+            deadline_nanoseconds = uint64_t(module->rt_check_deadline * 1e9 * opds->insdshead->ksmps / csound->GetSr(csound));
+        }
+        auto start = monotonic_nanoseconds();
+        if (factory_record->placement != nullptr && allocate_on_heap == false) {
+            // Construct the instance in memory owned by this instrument 
+            // instance. When Csound reuses the instrument instance, AuxAlloc 
+            // reuses the memory.
+            auto placement = factory_record->placement;
+            size_t size = placement->size + placement->alignment;
+            csound->AuxAlloc(csound, size, &invokable_memory);
+            void *memory = invokable_memory.auxp;
+            std::align(placement->alignment, placement->size, memory, size);
+            cxx_invokable = placement->construct(memory);
+            invokable_is_placed = true;
+        } else {
+            cxx_invokable = factory_record->factory();
+            invokable_is_placed = false;
+        }
+        cxx_invokable->set_argument_counts(uint32_t(output_count), uint32_t(input_count));
+        factory_record->instances.fetch_add(1, std::memory_order_relaxed);
+        auto dispatch = factory_record->dispatch;
+        if (thread != 1) {
+            kontrol_function = dispatch != nullptr ? dispatch->kontrol : &kontrol_virtual;
+        }
+        if (thread == 2) {
+            factory_record->init_stats.add(monotonic_nanoseconds() - start);
+            return result;
+        }
+        // Invoke the instance.
+        if (dispatch != nullptr) {
+            result = dispatch->init(cxx_invokable, csound, opds, outputs, inputs);
+        } else {
+            result = cxx_invokable->init(csound, opds, outputs, inputs);
+        }
+        factory_record->init_stats.add(monotonic_nanoseconds() - start);
+        if (module->log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_DEBUG)) {
+            log_from_performance(csound, "####### cxx_invoke::init: factory: %s instance: %p thread: %d result: %d\n", factory_record->name.c_str(), cxx_invokable, thread, result);
+        }
+        return result;
+    }
+    /**
+     * Must not be called if `is_silent()`.
      */
-    int init(CSOUND *csound)
+    inline int kontrol(CSOUND *csound, MYFLT **outputs, MYFLT **inputs)
     {
-        cxx_diagnostics_enabled() = false;
-        // Parse the compiler options.
-        auto cxx_command = csound->strarg2name(csound, (char *)0, S_compiler_command->data, (char *)"", 1);
-        std::vector<const char*> args;
-        std::vector<std::string> tokens;
-        tokenize(cxx_command, ' ', tokens);
-        for (int i = 0; i < tokens.size(); ++i) {
-            if (tokens[i] == "-v") {
-                cxx_diagnostics_enabled() = true;
+        if (rt_check != nullptr) {
+            return checked_kontrol(csound, outputs, inputs);
+        }
+        int result;
+        if (time_kontrol) {
+            auto start = monotonic_nanoseconds();
+            result = kontrol_function(cxx_invokable, csound, outputs, inputs);
+            kontrol_times.add(monotonic_nanoseconds() - start);
+            if (kontrol_times.count >= kontrol_times_merge_interval) {
+                factory_record->kontrol_stats.merge(kontrol_times);
             }
-            args.push_back(tokens[i].c_str());
+        } else {
+            result = kontrol_function(cxx_invokable, csound, outputs, inputs);
         }
-        //std::fprintf(stderr, "CxxCompile::init: line %d\n", __LINE__);
-        auto entry_point = csound->strarg2name(csound, (char *)0, S_entry_point->data, (char *)"", 1);
-        // Create a temporary file containing the source code.
-        auto source_code = csound->strarg2name(csound, (char *)0, S_source_code->data, (char *)"", 1);
-        char filepath[0x500];
-        {
-            std::lock_guard lock(get_mutex());
-            std::mt19937 mersenne_twister;
-            unsigned int seed_ = std::time(nullptr);
-            mersenne_twister.seed(seed_);
-            std::snprintf(filepath, 0x500, "%s/cxx_opcode_%lx.cpp", std::filesystem::temp_directory_path().c_str(), mersenne_twister());
-            auto file_ = fopen(filepath, "w+");
-            std::fwrite(source_code, strlen(source_code), sizeof(source_code[0]), file_);
-            std::fclose(file_);
+        if (result != OK && module->log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_WARNING)) {
+            log_from_performance(csound, "cxx_invoke: factory: %s instance: %p kontrol result: %d\n", factory_record->name.c_str(), cxx_invokable, result);
         }
-        args.push_back("cxx_opcode");
-        args.push_back(filepath);
-        char module_filepath[0x600];
-        std::snprintf(module_filepath, 0x600, "%s.so", filepath);
-        char compiler_command[0x2000];
-        std::snprintf(compiler_command, 0x2000, "%s %s -o%s\n", S_compiler_command->data, filepath, module_filepath);
-        if (cxx_diagnostics_enabled()) {    
-            csound->Message(csound, "####### cxx_compile: command:            %s\n", compiler_command);
+        return result;
+    }
+    /**
+     * As `kontrol`, for a module built with `-+cxx_rtcheck`.
+     */
+    int checked_kontrol(CSOUND *csound, MYFLT **outputs, MYFLT **inputs)
+    {
+        ++kontrol_calls;
+        rt_check(1, nullptr);
+        auto start = monotonic_nanoseconds();
+        int result = kontrol_function(cxx_invokable, csound, outputs, inputs);
+        auto elapsed = monotonic_nanoseconds() - start;
+        CxxRtViolations violations{};
+        rt_check(0, &violations);
+        kontrol_times.add(elapsed);
+        if (kontrol_times.count >= kontrol_times_merge_interval) {
+            factory_record->kontrol_stats.merge(kontrol_times);
         }
-        auto result = std::system(compiler_command);
-        if (cxx_diagnostics_enabled()) {
-            csound->Message(csound, "####### cxx_compile: result:             %d\n", result);
+        report_rt_check(csound, factory_record, "kontrol", kontrol_calls, violations, elapsed, deadline_nanoseconds);
+        if (result != OK && module->log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_WARNING)) {
+            log_from_performance(csound, "cxx_invoke: factory: %s instance: %p kontrol result: %d\n", factory_record->name.c_str(), cxx_invokable, result);
         }
-        // Compile the source code to a module, and call its
-        // csound_main entry point.
-        if (result == 0) {
-            // First, preload dynamic link libraries required by our compiled 
-            // module.
-            if (S_dynamic_link_libraries != nullptr) {
-                std::vector<std::string> dynamic_link_library_names;
-                auto dynamic_link_libraries = csound->strarg2name(csound, (char *)0, S_dynamic_link_libraries->data, (char *)"", 1);
-                tokenize(dynamic_link_libraries, ' ', dynamic_link_library_names);
-                for (const auto &dynamic_link_library_name : dynamic_link_library_names) {
-                    void *module_handle = nullptr;
-                    auto library_result = cxx_load_library(dynamic_link_library_name.c_str());
-#if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION)) 
-                    if (result != OK) {
-                            auto error_message = dlerror();
-                            csound->Message(csound, "Error: dlerror: \"%s\" when trying to load %s\n", error_message, dynamic_link_library_name.c_str());
-                    }
-#endif
-                    if (cxx_diagnostics_enabled() && library_result != nullptr) {
-                        csound->Message(csound, "####### cxx_compile: loaded dependency:  %s\n", dynamic_link_library_name.c_str());
-                    }
-                }
+        return result;
+    }
+    int noteoff(CSOUND *csound) {
+        int result = OK;
+        if (cxx_invokable != nullptr) {
+            auto start = monotonic_nanoseconds();
+            auto dispatch = factory_record->dispatch;
+            if (rt_check != nullptr) {
+                rt_check(1, nullptr);
             }
-            // Then, load our compiled module.
-            void *module_handle = nullptr;
-            ///result = csound->OpenLibrary(&module_handle, module_filepath);
-            module_handle = cxx_load_library(module_filepath);
-#if (defined(__linux__) || defined(__unix__) || defined(_POSIX_VERSION)) 
-            ///if (result != OK) {
-            if (module_handle == nullptr) {
-                    auto error_message = dlerror();
-                    csound->Message(csound, "Error: dlerror: %s\n", error_message);
+            if (dispatch != nullptr) {
+                result = dispatch->noteoff(cxx_invokable, csound);
+            } else {
+                result = cxx_invokable->noteoff(csound);
             }
-#endif
-            loaded_modules().push_back(module_handle);
-            csound_main_t entry_point_symbol = (csound_main_t) csound->GetLibrarySymbol(module_handle, entry_point);
-            if (cxx_diagnostics_enabled()) {
-                csound->Message(csound, "####### cxx_compile: module_filepath:    %s\n", module_filepath);
-                csound->Message(csound, "####### cxx_compile: module_handle:      %p\n", module_handle);
-                csound->Message(csound, "####### cxx_compile: entry_point:        %s\n", entry_point);
-                csound->Message(csound, "####### cxx_compile: entry_point_symbol: %p\n", entry_point_symbol);
+            if (rt_check != nullptr) {
+                CxxRtViolations violations{};
+                rt_check(0, &violations);
+                report_rt_check(csound, factory_record, "noteoff", 1, violations, 0, 0);
+            }
+            if (invokable_is_placed) {
+                cxx_invokable->~CxxInvokable();
+            } else {
+                cxx_invokable->release();
             }
-            result = entry_point_symbol(csound);
+            factory_record->noteoff_stats.add(monotonic_nanoseconds() - start);
+            factory_record->kontrol_stats.merge(kontrol_times);
+            if (module->log_levels.enabled(CXX_LOG_INVOKE, CXX_LOG_DEBUG)) {
+                log_from_performance(csound, "####### cxx_invoke::noteoff: factory: %s instance: %p result: %d\n", factory_record->name.c_str(), cxx_invokable, result);
+            }
+            cxx_invokable = nullptr;
+            kontrol_function = nullptr;
+            release_module(module);
+            module = nullptr;
         }
         return result;
-    };
+    }
 };
 
-#include "cxx_invokable.hpp"
-
-static std::mutex invokable_mutex;
-
 /**
  * Assuming that `cxx_compile` has already compiled a module that
  * implements a `CxxInvokable`, creates an instance of that
@@ -259,59 +4293,431 @@ public:
     MYFLT *i_thread;
     MYFLT *inputs[VARGMAX];
     // STATE
-    int thread;
-    CxxInvokable *cxx_invokable;
+    CxxInvocation invocation;
     int init(CSOUND *csound)
     {
-        std::lock_guard<std::mutex> lock(invokable_mutex);
-        int result = OK;
-        thread = (int) *i_thread;
-        // Look up factory.
-        auto invokable_factory_name = S_invokable_factory->data;
-        if (cxx_diagnostics_enabled()) csound->Message(csound,     "####### cxx_invoke::init: invokable_factory_name:  \"%s\" cxx_invokable: %p\n", invokable_factory_name, cxx_invokable);
-        // Create instance. We simply search through all the dynamic link 
-        // libraries compiled and loaded by this Csound process. TODO: If it 
-        // turns out that there are hundreds of these, make this more 
-        // efficient.
-        for (auto module_handle : loaded_modules()) {
-            if (cxx_diagnostics_enabled()) csound->Message(csound, "####### cxx_invoke::init: library handle:          %p\n", module_handle);
-            auto invokable_factory = (CxxInvokable *(*)()) csound->GetLibrarySymbol(module_handle, invokable_factory_name);
-            if (invokable_factory != nullptr) {
-                if (cxx_diagnostics_enabled()) csound->Message(csound, "####### cxx_invoke::init: found invokable factory: %p\n", invokable_factory);
-                cxx_invokable= invokable_factory();
-                if (cxx_diagnostics_enabled()) csound->Message(csound, "####### cxx_invoke::init: created new invokable:   %p for thread: %d\n", cxx_invokable, thread);
-                 if (thread == 2) {
-                    return result;
-                }
-                // Invoke the instance.
-                result = cxx_invokable->init(csound, &opds, outputs, inputs);
-                if (cxx_diagnostics_enabled()) csound->Message(csound, "####### cxx_invoke::init: result of invokation:    %d\n", result);
-                return result;
-            }
+        size_t output_count = std::min<size_t>(opds.optext->t.outArgCount, 40);
+        size_t input_count = std::max(0, int(opds.optext->t.inArgCount) - 2);
+        int result = invocation.init(csound, &opds, S_invokable_factory->data, (int) *i_thread, outputs, output_count, inputs, input_count, input_count);
+        if (invocation.is_silent()) {
+            output_silence(csound);
         }
         return result;
     }
     int kontrol(CSOUND *csound)
     {
-        int result = OK;
-        if (thread == 1) {
-            return result;
+        if (invocation.is_silent()) {
+            output_silence(csound);
+            return OK;
         }
-        result = cxx_invokable->kontrol(csound, outputs, inputs);
-        return result;
+        return invocation.kontrol(csound, outputs, inputs);
+    }
+    int noteoff(CSOUND *csound) {
+        return invocation.noteoff(csound);
+    }
+    /**
+     * Sets audio rate and control rate outputs to zero. Outputs of other 
+     * types are left alone.
+     */
+    void output_silence(CSOUND *csound)
+    {
+        auto output_count = std::min<unsigned>(opds.optext->t.outArgCount, 40);
+        for (unsigned index = 0; index < output_count; ++index) {
+            auto type = csound->GetTypeForArg(outputs[index]);
+            if (type == nullptr) {
+                continue;
+            }
+            if (std::strcmp(type->varTypeName, "a") == 0) {
+                std::memset(outputs[index], 0, opds.insdshead->ksmps * sizeof(MYFLT));
+            } else if (std::strcmp(type->varTypeName, "k") == 0 || std::strcmp(type->varTypeName, "i") == 0) {
+                *outputs[index] = 0;
+            }
+        }
+    }
+};
 
+/**
+ * Like `cxx_invoke`, but with one array of a-rate (if `audio`) or k-rate 
+ * signals for all outputs, and one for all inputs, so that a module can 
+ * have any number of channels, and can process them as one contiguous 
+ * matrix (see `cxx_channel_matrix`). The invokable receives the output 
+ * array as `outputs[0]` and the input array as `inputs[0]`.
+ */
+template<bool audio>
+class CxxInvokeArray : public csound::OpcodeNoteoffBase<CxxInvokeArray<audio>>
+{
+public:
+    // OUTPUTS
+    ARRAYDAT *outputs_array;
+    // INPUTS
+    STRINGDAT *S_invokable_factory;
+    MYFLT *i_thread;
+    MYFLT *i_output_channels;
+    ARRAYDAT *inputs_array;
+    // STATE
+    CxxInvocation invocation;
+    MYFLT *outputs[1];
+    MYFLT *inputs[1];
+    size_t output_bytes;
+    int init(CSOUND *csound)
+    {
+        size_t member_size = sizeof(MYFLT);
+        if (audio) {
+            member_size *= this->opds.insdshead->ksmps;
+        }
+        auto channels = std::max(0, int(*i_output_channels));
+        ensure_array(csound, outputs_array, channels, member_size);
+        output_bytes = channels * member_size;
+        outputs[0] = (MYFLT *) outputs_array;
+        inputs[0] = (MYFLT *) inputs_array;
+        int result = invocation.init(csound, &this->opds, S_invokable_factory->data, (int) *i_thread, outputs, 1, inputs, 1, 0);
+        if (invocation.is_silent()) {
+            std::memset(outputs_array->data, 0, output_bytes);
+        }
+        return result;
+    }
+    int kontrol(CSOUND *csound)
+    {
+        if (invocation.is_silent()) {
+            std::memset(outputs_array->data, 0, output_bytes);
+            return OK;
+        }
+        return invocation.kontrol(csound, outputs, inputs);
     }
     int noteoff(CSOUND *csound) {
-        if (cxx_diagnostics_enabled()) csound->Message(csound, "####### cxx_invoke::noteoff\n");
-        int result = OK;
-        result = cxx_invokable->noteoff(csound);
-        if (cxx_diagnostics_enabled()) csound->Message(csound, "####### cxx_invoke::noteoff: invokable::noteoff: result: %d\n", result);
-        if (cxx_invokable != nullptr) {
-            delete cxx_invokable;
-            cxx_invokable = nullptr;
+        return invocation.noteoff(csound);
+    }
+};
+
+/**
+ * A lock-free ring of blocks of `block_size` values, each tagged with the 
+ * kperiod that it belongs to, between one producer thread and one consumer 
+ * thread.
+ */
+struct BlockRing {
+    std::vector<MYFLT> values;
+    std::vector<int64_t> periods;
+    size_t block_size = 0;
+    size_t capacity = 0;
+    std::atomic<size_t> write_position{0};
+    std::atomic<size_t> read_position{0};
+    void resize(size_t capacity_, size_t block_size_) {
+        capacity = capacity_;
+        block_size = block_size_;
+        values.assign(capacity * std::max<size_t>(block_size, 1), MYFLT(0));
+        periods.assign(capacity, 0);
+        write_position = 0;
+        read_position = 0;
+    }
+    bool empty() const {
+        return read_position.load(std::memory_order_acquire) == write_position.load(std::memory_order_acquire);
+    }
+    bool full() const {
+        return write_position.load(std::memory_order_acquire) - read_position.load(std::memory_order_acquire) == capacity;
+    }
+    /**
+     * Returns the block to be filled by the producer; must not be called if 
+     * `full()`.
+     */
+    MYFLT *back() {
+        return &values[(write_position.load(std::memory_order_relaxed) % capacity) * block_size];
+    }
+    void push(int64_t period) {
+        auto position = write_position.load(std::memory_order_relaxed);
+        periods[position % capacity] = period;
+        write_position.store(position + 1, std::memory_order_release);
+    }
+    /**
+     * Returns the oldest block and its kperiod, or nullptr if `empty()`.
+     */
+    MYFLT *front(int64_t &period) {
+        auto position = read_position.load(std::memory_order_relaxed);
+        if (position == write_position.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        period = periods[position % capacity];
+        return &values[(position % capacity) * block_size];
+    }
+    void pop() {
+        read_position.store(read_position.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+/**
+ * The part of a `cxx_invoke_offload` instance that the offload pool runs: 
+ * it takes blocks of inputs from `input_ring`, calls the invokable's 
+ * `kontrol` with them, and puts the outputs in `output_ring`. Each block 
+ * holds the numeric arguments one after the other, at `input_offsets` or 
+ * `output_offsets`; other input arguments, such as strings and arrays, are 
+ * only passed to `init`, and are null for `kontrol`. Nothing that the job 
+ * uses points into the instrument instance, which Csound may reuse as soon 
+ * as the note ends.
+ */
+struct InvocationOffload : public OffloadJob {
+    CSOUND *csound = nullptr;
+    // Kept in the job rather than in the opcode, because the job may outlive 
+    // the note, and Csound reuses the opcode for the next note.
+    CxxInvocation invocation{};
+    // Copies of the opcode's `OPDS` and instrument instance taken at init 
+    // time, which the invokable is given instead of the originals, without 
+    // `ksmps_offset` and `ksmps_no_end`.
+    OPDS opds{};
+    INSDS instance{};
+    BlockRing input_ring;
+    BlockRing output_ring;
+    // For each argument, the offset in a block, or -1 to pass it through, 
+    // and the number of values in a block.
+    std::vector<ptrdiff_t> input_offsets;
+    std::vector<ptrdiff_t> output_offsets;
+    std::vector<size_t> input_sizes;
+    std::vector<size_t> output_sizes;
+    std::vector<MYFLT *> worker_inputs;
+    std::vector<MYFLT *> worker_outputs;
+    void run() override {
+        int64_t period;
+        MYFLT *input_block;
+        while (closed.load() == false && output_ring.full() == false && (input_block = input_ring.front(period)) != nullptr) {
+            auto output_block = output_ring.back();
+            for (size_t index = 0; index < input_offsets.size(); ++index) {
+                if (input_offsets[index] >= 0) {
+                    worker_inputs[index] = input_block + input_offsets[index];
+                }
+            }
+            for (size_t index = 0; index < output_offsets.size(); ++index) {
+                worker_outputs[index] = output_block + output_offsets[index];
+            }
+            invocation.kontrol(csound, worker_outputs.data(), worker_inputs.data());
+            output_ring.push(period);
+            input_ring.pop();
+        }
+    }
+    bool has_work() const override {
+        return input_ring.empty() == false && output_ring.full() == false;
+    }
+    void end() override {
+        invocation.noteoff(csound);
+    }
+};
+
+/**
+ * Like `cxx_invoke`, but `kontrol` runs on a pool of worker threads, 
+ * `i_periods` kperiods behind the performance thread, so that a module may 
+ * take longer than one kperiod to process a block as long as it keeps up 
+ * on average. The inputs of each kperiod are copied to the workers, and the 
+ * outputs are copied back `i_periods` kperiods later; the latency in 
+ * sample frames is returned in `i_latency`. If the output for a kperiod is 
+ * not ready in time, the opcode outputs silence for that kperiod, and 
+ * counts an underrun. Init runs on the performance thread, and so does 
+ * noteoff, unless a worker is still running `kontrol` when the note ends; 
+ * then the module reaper calls noteoff once the worker has stopped.
+ */
+class CxxInvokeOffload : public csound::OpcodeNoteoffBase<CxxInvokeOffload>
+{
+public:
+    // OUTPUTS
+    MYFLT *i_latency;
+    MYFLT *outputs[39];
+    // INPUTS
+    STRINGDAT *S_invokable_factory;
+    MYFLT *i_periods;
+    MYFLT *inputs[VARGMAX];
+    // STATE
+    InvocationOffload *offload;
+    int64_t period;
+    int64_t periods;
+    uint64_t underruns;
+    uint64_t overruns;
+    int init(CSOUND *csound)
+    {
+        if (offload != nullptr) {
+            // A tied note reuses the instance without a noteoff.
+            noteoff(csound);
+        }
+        period = 0;
+        periods = std::max(1, int(*i_periods));
+        underruns = 0;
+        overruns = 0;
+        uint32_t ksmps = opds.insdshead->ksmps;
+        *i_latency = MYFLT(periods * ksmps);
+        auto output_count = std::max(0, int(opds.optext->t.outArgCount) - 1);
+        auto input_count = std::max(0, int(opds.optext->t.inArgCount) - 2);
+        // Csound does not construct opcodes, so containers are kept in the 
+        // job.
+        auto job = new InvocationOffload;
+        job->input_sizes.assign(input_count, 0);
+        job->output_sizes.assign(output_count, 0);
+        job->csound = csound;
+        // The instance may outlive the note, so it must not be placed in the 
+        // instrument's memory.
+        job->invocation.allocate_on_heap = true;
+        job->input_offsets.assign(input_count, -1);
+        job->output_offsets.assign(output_count, 0);
+        job->worker_inputs.assign(input_count, nullptr);
+        job->worker_outputs.assign(output_count, nullptr);
+        job->instance = *opds.insdshead;
+        job->instance.ksmps_offset = 0;
+        job->instance.ksmps_no_end = 0;
+        job->opds = opds;
+        job->opds.nxti = nullptr;
+        job->opds.nxtp = nullptr;
+        job->opds.insdshead = &job->instance;
+        size_t input_block_size = 0;
+        for (int index = 0; index < input_count; ++index) {
+            auto size = argument_size(csound, inputs[index], ksmps);
+            if (size > 0) {
+                job->input_offsets[index] = input_block_size;
+                job->input_sizes[index] = size;
+                input_block_size += size;
+            }
+        }
+        size_t output_block_size = 0;
+        for (int index = 0; index < output_count; ++index) {
+            auto size = argument_size(csound, outputs[index], ksmps);
+            if (size == 0) {
+                delete job;
+                return csound->InitError(csound, "cxx_invoke_offload: output %d must be a-rate, k-rate, or i-time.\n", index + 2);
+            }
+            job->output_offsets[index] = output_block_size;
+            job->output_sizes[index] = size;
+            output_block_size += size;
+        }
+        // The workers are `periods` kperiods behind, plus one block that the 
+        // performance thread is writing, and one that a worker is writing.
+        job->input_ring.resize(periods + 1, input_block_size);
+        job->output_ring.resize(periods + 2, output_block_size);
+        offload = job;
+        auto &invocation = job->invocation;
+        int result = invocation.init(csound, &job->opds, S_invokable_factory->data, 3, outputs, output_count, inputs, input_count, input_count);
+        if (invocation.rt_check != nullptr) {
+            // With `-+cxx_rtcheck`, each block may take as long as the 
+            // latency.
+            invocation.deadline_nanoseconds *= periods;
+        }
+        output_silence();
+        if (result == OK && invocation.is_silent() == false) {
+            start_offload_pool(opcodes_state(csound).offload_pool);
+            start_module_reaper(opcodes_state(csound));
         }
         return result;
     }
+    int kontrol(CSOUND *csound)
+    {
+        if (offload->invocation.is_silent()) {
+            output_silence();
+            return OK;
+        }
+        // Send this kperiod's inputs.
+        auto &input_ring = offload->input_ring;
+        if (input_ring.full()) {
+            ++overruns;
+        } else {
+            auto block = input_ring.back();
+            auto &input_sizes = offload->input_sizes;
+            for (size_t index = 0; index < input_sizes.size(); ++index) {
+                if (input_sizes[index] > 0) {
+                    std::memcpy(block + offload->input_offsets[index], inputs[index], input_sizes[index] * sizeof(MYFLT));
+                }
+            }
+            input_ring.push(period);
+        }
+        submit_offload_job(opcodes_state(csound).offload_pool, offload);
+        // Receive the outputs of the kperiod `periods` ago, discarding any 
+        // that are too late.
+        auto target = period - periods;
+        ++period;
+        auto &output_ring = offload->output_ring;
+        int64_t output_period;
+        MYFLT *block;
+        while ((block = output_ring.front(output_period)) != nullptr && output_period < target) {
+            output_ring.pop();
+        }
+        if (block == nullptr || output_period != target) {
+            if (target >= 0) {
+                ++underruns;
+            }
+            output_silence();
+            return OK;
+        }
+        auto &output_sizes = offload->output_sizes;
+        for (size_t index = 0; index < output_sizes.size(); ++index) {
+            std::memcpy(outputs[index], block + offload->output_offsets[index], output_sizes[index] * sizeof(MYFLT));
+        }
+        output_ring.pop();
+        return OK;
+    }
+    int noteoff(CSOUND *csound) {
+        if (offload == nullptr) {
+            return OK;
+        }
+        if ((underruns > 0 || overruns > 0) && log_enabled(csound, CXX_LOG_INVOKE, CXX_LOG_WARNING)) {
+            log_from_performance(csound, "cxx_invoke_offload: factory \"%s\": %llu underruns, %llu overruns in %lld kperiods.\n", S_invokable_factory->data, (unsigned long long) underruns, (unsigned long long) overruns, (long long) period);
+        }
+        // After this, no worker starts to run the job. If a worker is still 
+        // running it, that worker leaves the job to the module reaper to be 
+        // ended when it stops; otherwise, the job is ended here.
+        offload->closed.store(true);
+        if (offload->busy.load() == false && offload->take_end()) {
+            offload->end();
+        }
+        release_offload_job(offload);
+        offload = nullptr;
+        return OK;
+    }
+    /**
+     * Returns the number of values of an a-rate, k-rate, or i-time 
+     * argument, or 0 for an argument of another type.
+     */
+    static size_t argument_size(CSOUND *csound, MYFLT *argument, uint32_t ksmps) {
+        auto type = csound->GetTypeForArg(argument);
+        if (type == nullptr) {
+            return 0;
+        }
+        if (std::strcmp(type->varTypeName, "a") == 0) {
+            return ksmps;
+        }
+        if (std::strcmp(type->varTypeName, "k") == 0 || std::strcmp(type->varTypeName, "i") == 0 || std::strcmp(type->varTypeName, "c") == 0) {
+            return 1;
+        }
+        return 0;
+    }
+    void output_silence()
+    {
+        if (offload == nullptr) {
+            return;
+        }
+        auto &output_sizes = offload->output_sizes;
+        for (size_t index = 0; index < output_sizes.size(); ++index) {
+            std::memset(outputs[index], 0, output_sizes[index] * sizeof(MYFLT));
+        }
+    }
+};
+
+/**
+ * Returns the statistics of the current version of a factory at i-time and 
+ * every kperiod, in an array laid out as described for `cxx_stats_size`. 
+ * Times are in seconds. The statistics of `kontrol` calls are updated when 
+ * an instance ends, and otherwise every few thousand kperiods. If the 
+ * factory does not exist (yet), all values are 0.
+ */
+class CxxStats : public csound::OpcodeBase<CxxStats>
+{
+public:
+    // OUTPUTS
+    ARRAYDAT *k_stats;
+    // INPUTS
+    STRINGDAT *S_invokable_factory;
+    // STATE
+    int init(CSOUND *csound)
+    {
+        ensure_array(csound, k_stats, cxx_stats_size);
+        return kontrol(csound);
+    }
+    int kontrol(CSOUND *csound)
+    {
+        auto record = lookup_factory_record(opcodes_state(csound), S_invokable_factory->data);
+        report_factory_stats(record, k_stats->data);
+        return OK;
+    }
 };
 
 std::vector<std::string> get_operating_system() {
@@ -482,6 +4888,9 @@ extern "C" {
 
     PUBLIC int csoundModuleInit_cxx_opcodes(CSOUND *csound)
     {
+        create_opcodes_state(csound);
+        create_channel_registry(csound);
+        create_mapped_file_registry(csound);
         int status = csound->AppendOpcode(csound,
                                           (char *)"cxx_compile",
                                           sizeof(CxxCompile),
@@ -502,6 +4911,146 @@ extern "C" {
                                           (int (*)(CSOUND*,void*)) CxxInvoke::init_,
                                           (int (*)(CSOUND*,void*)) CxxInvoke::kontrol_,
                                           (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_invoke_array",
+                                          sizeof(CxxInvokeArray<true>),
+                                          0,
+                                          3,
+                                          (char *)"a[]",
+                                          (char *)"Siia[]",
+                                          (int (*)(CSOUND*,void*)) CxxInvokeArray<true>::init_,
+                                          (int (*)(CSOUND*,void*)) CxxInvokeArray<true>::kontrol_,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_invoke_array",
+                                          sizeof(CxxInvokeArray<false>),
+                                          0,
+                                          3,
+                                          (char *)"k[]",
+                                          (char *)"Siik[]",
+                                          (int (*)(CSOUND*,void*)) CxxInvokeArray<false>::init_,
+                                          (int (*)(CSOUND*,void*)) CxxInvokeArray<false>::kontrol_,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_invoke_offload",
+                                          sizeof(CxxInvokeOffload),
+                                          0,
+                                          3,
+                                          (char *)"****************************************",
+                                          (char *)"SiN",
+                                          (int (*)(CSOUND*,void*)) CxxInvokeOffload::init_,
+                                          (int (*)(CSOUND*,void*)) CxxInvokeOffload::kontrol_,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_stats",
+                                          sizeof(CxxStats),
+                                          0,
+                                          3,
+                                          (char *)"k[]",
+                                          (char *)"S",
+                                          (int (*)(CSOUND*,void*)) CxxStats::init_,
+                                          (int (*)(CSOUND*,void*)) CxxStats::kontrol_,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_async",
+                                          sizeof(CxxCompileAsync),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"SSW",
+                                          (int (*)(CSOUND*,void*)) CxxCompileAsync::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_recompile",
+                                          sizeof(CxxRecompile),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"SSW",
+                                          (int (*)(CSOUND*,void*)) CxxRecompile::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_status",
+                                          sizeof(CxxCompileStatus),
+                                          0,
+                                          3,
+                                          (char *)"k",
+                                          (char *)"i",
+                                          (int (*)(CSOUND*,void*)) CxxCompileStatus::init_,
+                                          (int (*)(CSOUND*,void*)) CxxCompileStatus::kontrol_,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_wait",
+                                          sizeof(CxxCompileWait),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"i",
+                                          (int (*)(CSOUND*,void*)) CxxCompileWait::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_declare",
+                                          sizeof(CxxCompileDeclare),
+                                          0,
+                                          1,
+                                          (char *)"",
+                                          (char *)"SSW",
+                                          (int (*)(CSOUND*,void*)) CxxCompileDeclare::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_all",
+                                          sizeof(CxxCompileAll),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"o",
+                                          (int (*)(CSOUND*,void*)) CxxCompileAll::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_lazy",
+                                          sizeof(CxxCompileLazy),
+                                          0,
+                                          1,
+                                          (char *)"",
+                                          (char *)"SSSW",
+                                          (int (*)(CSOUND*,void*)) CxxCompileLazy::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_compile_prefetch",
+                                          sizeof(CxxCompilePrefetch),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"So",
+                                          (int (*)(CSOUND*,void*)) CxxCompilePrefetch::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_cache",
+                                          sizeof(CxxCache),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"Si",
+                                          (int (*)(CSOUND*,void*)) CxxCache::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
+        status += csound->AppendOpcode(csound,
+                                          (char *)"cxx_cache_evict",
+                                          sizeof(CxxCacheEvict),
+                                          0,
+                                          1,
+                                          (char *)"i",
+                                          (char *)"o",
+                                          (int (*)(CSOUND*,void*)) CxxCacheEvict::init_,
+                                          (int (*)(CSOUND*,void*)) 0,
+                                          (int (*)(CSOUND*,void*)) 0);
         status += csound->AppendOpcode(csound,
                                           (char *)"cxx_os",
                                           sizeof(CxxOperatingSystem),
@@ -527,7 +5076,17 @@ extern "C" {
 
     PUBLIC int csoundModuleDestroy_cxx_opcodes(CSOUND *csound)
     {
-        loaded_modules().clear();
+        {
+            std::vector<LazyModule> modules;
+            take_lazy_modules(csound, nullptr, modules);
+        }
+        join_async_compilations(csound);
+        {
+            std::vector<ModuleDeclaration> declarations;
+            std::lock_guard<std::mutex> lock(module_declarations_mutex());
+            take_module_declarations(csound, declarations);
+        }
+        destroy_opcodes_state(csound);
         return 0;
     }
 
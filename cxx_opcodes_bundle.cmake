@@ -0,0 +1,177 @@
+# cxx_opcodes_bundle.cmake - this file is part of csound-cxx-opcodes.
+#
+# Builds the modules that a .csd compiles with cxx_compile, cxx_compile_async,
+# cxx_recompile, cxx_compile_declare, or cxx_compile_lazy ahead of time, into
+# one shared library, so that Csound can run the .csd without a compiler:
+#
+#   include(cxx_opcodes_bundle.cmake)
+#   cxx_opcodes_bundle(my_piece_bundle
+#       CSD my_piece.csd
+#       [COMPILE_OPTIONS option...]
+#       [LINK_LIBRARIES library...])
+#
+# For each call whose source is a {{...}} literal assigned to a variable, and
+# whose compiler command is a "..." literal, the source is written to
+# <target>/<entry_point>.cpp and compiled with the -D, -U, -std, -O, and
+# -f options of the compiler command, as well as its -I and -L options for
+# directories that exist on the build machine, and linked with its -l
+# options. The library also contains a manifest, the function
+# cxx_bundle_entries (see CxxBundleEntry in cxx_invokable.hpp), which
+# lists each entry point with its source code, and the function
+# cxx_bundle_interface_version; and a text manifest,
+# <target>.manifest, is written next to the library. At run time,
+# cxx_compile uses the bundled module if the bundle is listed in the
+# environment variable CXX_OPCODES_BUNDLE, the bundle was built against the
+# same CXX_INVOKABLE_INTERFACE_VERSION, and the entry point and source code
+# match. Each Csound instance loads its own copy of the bundle, so instances
+# do not share the static data of its modules.
+#
+# Each module's cxx_invokable_factories function, if any, is renamed to
+# <entry_point>_cxx_invokable_factories, so that modules can be linked
+# together; other symbols with external linkage must not be defined by more
+# than one module.
+#
+# The .csd is parsed when CMake configures the build, and the build is
+# configured again whenever the .csd changes.
+
+set(CXX_OPCODES_BUNDLE_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
+# Undoes the escapes that Csound processes in {{...}} strings.
+function(cxx_opcodes_bundle_unescape text result)
+    string(REPLACE "\\\\" "@CXX_BACKSLASH@" text "${text}")
+    string(REPLACE "\\n" "\n" text "${text}")
+    string(REPLACE "\\t" "\t" text "${text}")
+    string(REPLACE "\\r" "\r" text "${text}")
+    string(REPLACE "\\\"" "\"" text "${text}")
+    string(REPLACE "@CXX_BACKSLASH@" "\\" text "${text}")
+    set(${result} "${text}" PARENT_SCOPE)
+endfunction()
+
+# Finds the {{...}} literals assigned to variables, with `S_name init {{` or
+# `S_name = {{`, and sets <prefix>_<name> to each one's source code.
+function(cxx_opcodes_bundle_find_sources content prefix names)
+    set(found "")
+    set(position 0)
+    string(LENGTH "${content}" length)
+    while(position LESS length)
+        string(SUBSTRING "${content}" ${position} -1 rest)
+        string(FIND "${rest}" "{{" open)
+        if(open EQUAL -1)
+            break()
+        endif()
+        math(EXPR open "${position} + ${open}")
+        math(EXPR body_start "${open} + 2")
+        string(SUBSTRING "${content}" ${body_start} -1 rest)
+        string(FIND "${rest}" "}}" close)
+        if(close EQUAL -1)
+            break()
+        endif()
+        string(SUBSTRING "${rest}" 0 ${close} body)
+        math(EXPR position "${body_start} + ${close} + 2")
+        string(SUBSTRING "${content}" 0 ${open} before)
+        string(FIND "${before}" "\n" line_start REVERSE)
+        math(EXPR line_start "${line_start} + 1")
+        string(SUBSTRING "${before}" ${line_start} -1 line)
+        if(line MATCHES "([A-Za-z_][A-Za-z0-9_]*)[ \t]*(init|=)[ \t]*$")
+            set(name "${CMAKE_MATCH_1}")
+            cxx_opcodes_bundle_unescape("${body}" body)
+            set(${prefix}_${name} "${body}" PARENT_SCOPE)
+            list(APPEND found "${name}")
+        endif()
+    endwhile()
+    set(${names} "${found}" PARENT_SCOPE)
+endfunction()
+
+function(cxx_opcodes_bundle target)
+    cmake_parse_arguments(BUNDLE "" "" "CSD;COMPILE_OPTIONS;LINK_LIBRARIES" ${ARGN})
+    if(NOT BUNDLE_CSD)
+        message(FATAL_ERROR "cxx_opcodes_bundle: ${target}: no CSD was given.")
+    endif()
+    set(directory "${CMAKE_CURRENT_BINARY_DIR}/${target}")
+    file(MAKE_DIRECTORY "${directory}")
+    set(module_sources "")
+    set(entry_points "")
+    set(link_options "")
+    set(manifest_text "")
+    set(manifest_sources "")
+    set(manifest_entries "")
+    foreach(csd ${BUNDLE_CSD})
+        get_filename_component(csd "${csd}" ABSOLUTE)
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${csd}")
+        file(READ "${csd}" content)
+        cxx_opcodes_bundle_find_sources("${content}" source names)
+        set(call_pattern "cxx_(compile|compile_async|recompile|compile_declare|compile_lazy)[ \t]+\"([^\"]+)\"[ \t]*,[ \t]*(\"[^\"]*\"[ \t]*,[ \t]*)?([A-Za-z_][A-Za-z0-9_]*)[ \t]*,[ \t]*\"([^\"]*)\"")
+        string(REGEX MATCHALL "${call_pattern}" calls "${content}")
+        foreach(call ${calls})
+            string(REGEX MATCH "${call_pattern}" call "${call}")
+            set(opcode "cxx_${CMAKE_MATCH_1}")
+            set(entry_point "${CMAKE_MATCH_2}")
+            set(variable "${CMAKE_MATCH_4}")
+            set(command "${CMAKE_MATCH_5}")
+            if(NOT DEFINED source_${variable})
+                message(WARNING "cxx_opcodes_bundle: ${target}: the source of \"${entry_point}\", ${variable}, is not a {{...}} literal in ${csd}; not bundled.")
+                continue()
+            endif()
+            # The same module may be compiled with different commands on
+            # different platforms; the first one is used.
+            list(FIND entry_points "${entry_point}" index)
+            if(NOT index EQUAL -1)
+                continue()
+            endif()
+            list(APPEND entry_points "${entry_point}")
+            set(module_source "${directory}/${entry_point}.cpp")
+            file(WRITE "${module_source}.new" "${source_${variable}}")
+            configure_file("${module_source}.new" "${module_source}" COPYONLY)
+            separate_arguments(tokens UNIX_COMMAND "${command}")
+            set(compile_options "-Dcxx_invokable_factories=${entry_point}_cxx_invokable_factories")
+            foreach(token ${tokens})
+                if(token MATCHES "^-(D|U|std=|O|f)" AND NOT token MATCHES "^-f(PIC|pic)$")
+                    list(APPEND compile_options "${token}")
+                elseif(token MATCHES "^-I(.+)$" AND IS_DIRECTORY "${CMAKE_MATCH_1}")
+                    list(APPEND compile_options "${token}")
+                elseif(token MATCHES "^-L(.+)$" AND IS_DIRECTORY "${CMAKE_MATCH_1}")
+                    list(APPEND link_options "${token}")
+                elseif(token MATCHES "^-l.+$")
+                    list(APPEND link_options "${token}")
+                endif()
+            endforeach()
+            set_source_files_properties("${module_source}" PROPERTIES COMPILE_OPTIONS "${compile_options}")
+            list(APPEND module_sources "${module_source}")
+            list(LENGTH entry_points module_index)
+            string(APPEND manifest_sources "static const char source_${module_index}[] = R\"cxx_bundle(${source_${variable}})cxx_bundle\";\n")
+            string(APPEND manifest_entries "        {\"${entry_point}\", source_${module_index}},\n")
+            string(APPEND manifest_text "${entry_point}\t${csd}\t${module_source}\n")
+        endforeach()
+    endforeach()
+    if(NOT entry_points)
+        message(FATAL_ERROR "cxx_opcodes_bundle: ${target}: no modules were found in ${BUNDLE_CSD}.")
+    endif()
+    set(manifest_source "${directory}/cxx_bundle_manifest.cpp")
+    file(WRITE "${manifest_source}.new"
+        "#include <cxx_invokable.hpp>\n"
+        "${manifest_sources}"
+        "extern \"C\" const CxxBundleEntry *cxx_bundle_entries() {\n"
+        "    static const CxxBundleEntry entries[] = {\n"
+        "${manifest_entries}"
+        "        {nullptr, nullptr},\n"
+        "    };\n"
+        "    return entries;\n"
+        "}\n"
+        "extern \"C\" int cxx_bundle_interface_version() {\n"
+        "    return CXX_INVOKABLE_INTERFACE_VERSION;\n"
+        "}\n")
+    configure_file("${manifest_source}.new" "${manifest_source}" COPYONLY)
+    file(WRITE "${directory}/${target}.manifest.new" "${manifest_text}")
+    configure_file("${directory}/${target}.manifest.new" "${directory}/${target}.manifest" COPYONLY)
+    add_library(${target} SHARED ${module_sources} "${manifest_source}")
+    set_target_properties(${target} PROPERTIES PREFIX "")
+    target_include_directories(${target} PRIVATE
+        "${CXX_OPCODES_BUNDLE_DIR}"
+        "${CXX_OPCODES_BUNDLE_DIR}/csound/include"
+        "${CXX_OPCODES_BUNDLE_DIR}/csound/interfaces")
+    target_compile_options(${target} PRIVATE ${BUNDLE_COMPILE_OPTIONS})
+    list(REMOVE_DUPLICATES link_options)
+    target_link_libraries(${target} PRIVATE ${link_options} ${BUNDLE_LINK_LIBRARIES})
+    add_custom_command(TARGET ${target} POST_BUILD
+        COMMAND ${CMAKE_COMMAND} -E copy "${directory}/${target}.manifest" "$<TARGET_FILE_DIR:${target}>/${target}.manifest")
+endfunction()